@@ -0,0 +1,283 @@
+//
+// Tap-tempo tracking library benchmark.
+// 
+// Copyright (C) 2013-2016 Harald Sabro
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Contact info
+// ------------
+// Website: sabrotone.com
+// Email: harald (AT) website 
+//
+
+
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "taptempo.h"
+
+//
+// Times TapTempoPush() and TapTempoPushArray() on the host and prints the
+// results as JSON: nanoseconds per tap and taps per second, as the mean over
+// a number of runs, with the run-to-run spread alongside to tell a real change
+// from noise.
+//
+// Usage: bench_taptempo [taps per run] [runs]
+//
+
+#define DEFAULT_TAP_COUNT               1000000UL
+#define DEFAULT_RUN_COUNT               10
+
+typedef struct
+{
+    const char *name;
+    double mean;
+    double variance;
+    double min;
+    double max;
+} BenchResult;
+
+//
+// Local function prototypes.
+//
+
+static void GenerateTimestamps(uint32_t *timestamps, uint32_t count);
+static double RunPush(const uint32_t *timestamps, uint32_t count);
+static double RunPushArray(const uint32_t *timestamps, TapTempoResult *results, uint32_t count);
+static double GetSeconds();
+static void Summarize(BenchResult *result, const char *name, const double *ns_per_tap, int runs);
+static void PrintResult(const BenchResult *result, int is_last);
+
+//
+// Results are folded into this, so the compiler can't drop the work.
+//
+
+static volatile uint32_t s_checksum;
+
+/*====== Public functions ===================================================== 
+=============================================================================*/
+
+int main(int argc, char *argv[])
+{
+    uint32_t count = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 10) : DEFAULT_TAP_COUNT;
+    int runs = (argc > 2) ? atoi(argv[2]) : DEFAULT_RUN_COUNT;
+    uint32_t *timestamps;
+    TapTempoResult *results;
+    double *ns_per_tap;
+    BenchResult push;
+    BenchResult push_array;
+    int run;
+    
+    if ((count == 0) || (runs < 1))
+    {
+        fprintf(stderr, "usage: %s [taps per run] [runs]\n", argv[0]);
+        return 1;
+    }
+    
+    timestamps = malloc(count * sizeof(*timestamps));
+    results = malloc(count * sizeof(*results));
+    ns_per_tap = malloc(runs * sizeof(*ns_per_tap));
+    
+    if ((timestamps == NULL) || (results == NULL) || (ns_per_tap == NULL))
+    {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return 1;
+    }
+    
+    GenerateTimestamps(timestamps, count);
+    
+    //
+    // One untimed pass first, to get the data into the cache.
+    //
+    
+    RunPush(timestamps, count);
+    
+    for (run = 0; run < runs; run++)
+    {
+        ns_per_tap[run] = RunPush(timestamps, count) * 1e9 / count;
+    }
+    
+    Summarize(&push, "TapTempoPush", ns_per_tap, runs);
+    
+    for (run = 0; run < runs; run++)
+    {
+        ns_per_tap[run] = RunPushArray(timestamps, results, count) * 1e9 / count;
+    }
+    
+    Summarize(&push_array, "TapTempoPushArray", ns_per_tap, runs);
+    
+    printf("{\n  \"taps_per_run\": %lu,\n  \"runs\": %d,\n  \"benchmarks\": [\n", (unsigned long)count, runs);
+    PrintResult(&push, 0);
+    PrintResult(&push_array, 1);
+    printf("  ]\n}\n");
+    
+    free(ns_per_tap);
+    free(results);
+    free(timestamps);
+    
+    return 0;
+}
+
+/*====== Local functions ====================================================== 
+=============================================================================*/
+
+static void GenerateTimestamps(uint32_t *timestamps, uint32_t count)
+{
+    //
+    // Hand tapping: a tempo that changes every few dozen taps, a few percent
+    // of jitter, and the odd double trigger and long pause, so every path
+    // through the tracker gets its share. Starts near the top of the counter
+    // to cross the wrap around.
+    //
+    
+    uint32_t seed = 0x2545f491UL;
+    uint32_t now = 0xfff00000UL;
+    uint16_t tempo = 500;
+    uint32_t i;
+    
+    for (i = 0; i < count; i++)
+    {
+        uint32_t bits;
+        
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        bits = seed;
+        
+        if ((bits & 0x3f) == 0)
+        {
+            tempo = 100 + ((bits >> 8) % 1900);
+        }
+        
+        if ((bits & 0x3ff00) == 0)
+        {
+            now += 5;
+        }
+        else if ((bits & 0x3ff00) == 0x100)
+        {
+            now += 20000;
+        }
+        else
+        {
+            now += tempo - (tempo / 32) + ((bits >> 20) % ((tempo / 16) + 1));
+        }
+        
+        timestamps[i] = now;
+    }
+}
+
+static double RunPush(const uint32_t *timestamps, uint32_t count)
+{
+    TapTempo tap_tempo;
+    uint32_t checksum = 0;
+    double start;
+    uint32_t i;
+    
+    TapTempoInitialize(&tap_tempo, 50, 10000);
+    
+    start = GetSeconds();
+    
+    for (i = 0; i < count; i++)
+    {
+        TapTempoResult result = TapTempoPush(&tap_tempo, timestamps[i]);
+        
+        checksum += result.tempo + result.phase + result.confidence;
+    }
+    
+    start = GetSeconds() - start;
+    s_checksum += checksum;
+    
+    return start;
+}
+
+static double RunPushArray(const uint32_t *timestamps, TapTempoResult *results, uint32_t count)
+{
+    TapTempo tap_tempo;
+    double start;
+    
+    TapTempoInitialize(&tap_tempo, 50, 10000);
+    
+    start = GetSeconds();
+    TapTempoPushArray(&tap_tempo, timestamps, results, count);
+    start = GetSeconds() - start;
+    
+    s_checksum += results[count - 1].tempo;
+    
+    return start;
+}
+
+static double GetSeconds()
+{
+    struct timespec now;
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    
+    return now.tv_sec + (now.tv_nsec * 1e-9);
+}
+
+static void Summarize(BenchResult *result, const char *name, const double *ns_per_tap, int runs)
+{
+    double sum = 0;
+    double square_sum = 0;
+    int run;
+    
+    result->name = name;
+    result->min = ns_per_tap[0];
+    result->max = ns_per_tap[0];
+    
+    for (run = 0; run < runs; run++)
+    {
+        sum += ns_per_tap[run];
+        
+        if (ns_per_tap[run] < result->min)
+        {
+            result->min = ns_per_tap[run];
+        }
+        
+        if (ns_per_tap[run] > result->max)
+        {
+            result->max = ns_per_tap[run];
+        }
+    }
+    
+    result->mean = sum / runs;
+    
+    for (run = 0; run < runs; run++)
+    {
+        square_sum += (ns_per_tap[run] - result->mean) * (ns_per_tap[run] - result->mean);
+    }
+    
+    //
+    // Sample variance; there's no spread to speak of with a single run.
+    //
+    
+    result->variance = (runs > 1) ? (square_sum / (runs - 1)) : 0;
+}
+
+static void PrintResult(const BenchResult *result, int is_last)
+{
+    printf("    {\n");
+    printf("      \"name\": \"%s\",\n", result->name);
+    printf("      \"ns_per_tap\": { \"mean\": %.3f, \"stddev\": %.3f, \"variance\": %.4f, \"min\": %.3f, \"max\": %.3f },\n",
+        result->mean, sqrt(result->variance), result->variance, result->min, result->max);
+    printf("      \"taps_per_second\": %.0f\n", 1e9 / result->mean);
+    printf("    }%s\n", is_last ? "" : ",");
+}
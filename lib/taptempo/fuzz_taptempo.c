@@ -0,0 +1,783 @@
+//
+// Tap-tempo tracking library fuzz target.
+// 
+// Copyright (C) 2013-2016 Harald Sabro
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Contact info
+// ------------
+// Website: sabrotone.com
+// Email: harald (AT) website 
+//
+
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "taptempo.h"
+#include "tempo.h"
+
+//
+// Drives random event streams through the tracker on its own (TapTempoPush()),
+// and through the tempo, speed adjustment and multiplier alignment code the
+// firmware builds from the same sources (taptempo.c, tempo.c), and aborts as
+// soon as an invariant breaks. Build it with the sanitizers on ("make fuzz"
+// for libFuzzer, "make fuzz-run" for the standalone driver below), so integer
+// and memory errors abort too.
+//
+// The first input byte picks a firmware build (see k_build), the rest is a
+// list of 3 byte events: an operation and a 16-bit argument.
+//
+// The Clock* and Lfo* functions below only hold the firmware's state and call
+// into the shared code the way signaling.c does (attiny861, and attiny84a /
+// attiny85 respectively); all of the arithmetic is the firmware's own.
+//
+
+//
+// Tempo limits, the same on every chip (signaling.h), and the fine speed
+// adjustment of the attiny861.
+//
+
+#define LFO_MIN_TEMPO                   10000
+#define LFO_MAX_TEMPO                   50
+#define DEFAULT_TEMPO                   1000
+
+//
+// Multiplier ratio limits: RATIO_MAX of the attiny84a, and the attiny85
+// multipliers, which all line up within its 12 beat alignment span.
+//
+
+#define RATIO_MAX                       16
+#define MULTIPLIER_ALIGNMENT_OFFSET     12
+
+//
+// Largest step the outputs' phase may take across a beat that is exactly on
+// time: the base phase is taken at 24 bits, so its last step is 256, times at
+// most RATIO_MAX for the output, plus rounding.
+//
+
+#define BEAT_PHASE_TOLERANCE            ((RATIO_MAX + 1) << 8)
+
+#define CHECK(condition)                Check((condition), #condition, __LINE__)
+
+typedef enum
+{
+    EventPush,
+    EventTick,
+    EventTap,
+    EventSetBaseTempo,
+    EventAdjustSpeed,
+    EventFineAdjustSpeed,
+    EventResetSpeedAdjust,
+    EventClearAverage,
+    EventSyncInterval,
+    EventSetRatio,
+    EventSetBasePhase,
+    EventBaseWrap,
+    EventSkipBeats,
+    EventResetAlignment,
+    EventCount
+} Event;
+
+//
+// A firmware build: clock rate and PWM period (attiny861 TIMER1_PERIOD,
+// attiny84a / attiny85 WAVEFORM_RESOLUTION), BPM_QUANTIZE, and the alignment
+// span the multipliers count over.
+//
+
+typedef struct
+{
+    uint32_t clock;
+    uint16_t period;
+    uint8_t quantize;
+    uint8_t alignment_base_period;
+} Build;
+
+static const Build k_build[] =
+{
+    {  8000000,  256, 0, 1 },                               // attiny861.
+    {  8000000, 1024, 0, 1 },                               // attiny861, LFO_OUTPUTS.
+    {  8000000,  256, 1, 1 },                               // attiny861, BPM_QUANTIZE=1.
+    {  8000000, 1024, 2, 1 },                               // attiny861, LFO_OUTPUTS, BPM_QUANTIZE=2.
+    {  8000000,  256, 0, 1 },                               // attiny84a.
+    { 20000000,  256, 1, 1 },                               // attiny84a, 20MHz, BPM_QUANTIZE=1.
+    {  8000000,  256, 0, MULTIPLIER_ALIGNMENT_OFFSET },     // attiny85.
+    { 16000000,  256, 2, MULTIPLIER_ALIGNMENT_OFFSET }      // attiny85, 16MHz, BPM_QUANTIZE=2.
+};
+
+#define BUILD_COUNT                     (sizeof(k_build) / sizeof(k_build[0]))
+
+//
+// The build's constants, worked out the way the firmware does at compile
+// time.
+//
+
+typedef struct
+{
+    const Build *build;
+    uint32_t duty_cycle_dividend;
+    uint32_t quantize_dividend;
+    uint32_t step_duty_cycle;
+    uint32_t duty_cycle_min;
+    uint32_t duty_cycle_max;
+} Constants;
+
+//
+// attiny861 speed state (signaling.c).
+//
+
+typedef struct
+{
+    TapTempo tap_tempo;
+    uint16_t base_tempo;
+    int16_t tempo_adjust_offset;
+    int16_t tempo_fine_trim;
+    uint32_t base_duty_cycle;
+    uint8_t is_counting_tempo;
+    uint8_t is_averaging_tempo;
+    uint16_t tempo_ms_count;
+} Clock;
+
+//
+// attiny84a / attiny85 tempo and multiplier alignment state (signaling.c).
+//
+
+typedef struct
+{
+    TapTempo tap_tempo;
+    uint16_t base_tempo;
+    uint32_t base_duty_cycle;
+    uint8_t is_averaging_tempo;
+    TempoAlignment alignment;
+    uint32_t base_phase;
+} Lfo;
+
+//
+// Local function prototypes.
+//
+
+static void Check(int condition, const char *text, int line);
+static void CheckTracker(const TapTempo *tap_tempo);
+static void CheckClock(const Clock *clock, const Constants *constants);
+static void CheckLfo(const Lfo *lfo, const Constants *constants);
+static void CheckAlignment(const TempoAlignment *alignment, uint32_t base_phase);
+static uint32_t CalcReferencePhase(const TempoRatio *ratio, uint32_t base_phase);
+static uint8_t CalcGreatestCommonDivisor(uint8_t a, uint8_t b);
+
+static void LoadConstants(Constants *constants, const Build *build);
+static uint32_t CalcBaseDutyCycle(const Constants *constants, uint16_t tempo);
+
+static void ClockInitialize(Clock *clock, const Constants *constants);
+static void ClockSetBaseTempo(Clock *clock, const Constants *constants, uint16_t milliseconds);
+static void ClockTick(Clock *clock, uint16_t milliseconds);
+static void ClockTap(Clock *clock, const Constants *constants);
+static void ClockAdjustSpeed(Clock *clock, const Constants *constants, int16_t change_value);
+static void ClockFineAdjustSpeed(Clock *clock, const Constants *constants, int8_t change_value);
+static void ClockRecalculateTempo(Clock *clock, const Constants *constants);
+
+static void LfoInitialize(Lfo *lfo, const Constants *constants);
+static void LfoSetBaseTempo(Lfo *lfo, const Constants *constants, uint16_t milliseconds, uint8_t is_sync_tempo);
+static void LfoSetRatio(Lfo *lfo, uint16_t argument);
+static void LfoBaseWrap(Lfo *lfo);
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+/*====== Public functions ===================================================== 
+=============================================================================*/
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    Constants constants;
+    TapTempo stream;
+    Clock clock;
+    Lfo lfo;
+    size_t i;
+    
+    //
+    // Start the stream's clock just short of the wrap around, so long inputs
+    // cross it.
+    //
+    
+    uint32_t now = 0xffff0000UL;
+    
+    if (size < 1)
+    {
+        return 0;
+    }
+    
+    LoadConstants(&constants, &k_build[data[0] % BUILD_COUNT]);
+    
+    TapTempoInitialize(&stream, LFO_MAX_TEMPO, LFO_MIN_TEMPO);
+    ClockInitialize(&clock, &constants);
+    LfoInitialize(&lfo, &constants);
+    
+    for (i = 1; (i + 3) <= size; i += 3)
+    {
+        uint16_t argument = data[i + 1] | ((uint16_t)data[i + 2] << 8);
+        
+        switch (data[i] % EventCount)
+        {
+            case EventPush:
+            {
+                TapTempo before = stream;
+                TapTempoResult result;
+                
+                now += argument;
+                result = TapTempoPush(&stream, now);
+                
+                CHECK(result.tempo == stream.tempo);
+                CHECK(result.confidence == stream.confidence);
+                CHECK((before.tempo != 0) || (result.phase == 0));
+                
+                //
+                // Only a bounce may leave the previous tap where it was;
+                // anything else moves it, or the tracker would be stuck
+                // measuring from a tap long gone.
+                //
+                
+                if ((before.is_counting == 1) && ((now - before.previous_tap) < LFO_MAX_TEMPO))
+                {
+                    CHECK(stream.previous_tap == before.previous_tap);
+                }
+                else
+                {
+                    CHECK(stream.is_counting == 1);
+                    CHECK(stream.previous_tap == now);
+                }
+                
+                CheckTracker(&stream);
+                break;
+            }
+            
+            case EventTick:
+                ClockTick(&clock, argument & 0x3fff);
+                break;
+            
+            case EventTap:
+                ClockTap(&clock, &constants);
+                LfoSetBaseTempo(&lfo, &constants, argument & 0x3fff, 0);
+                break;
+            
+            case EventSetBaseTempo:
+                ClockSetBaseTempo(&clock, &constants, argument);
+                break;
+            
+            case EventAdjustSpeed:
+                ClockAdjustSpeed(&clock, &constants, (int8_t)argument);
+                break;
+            
+            case EventFineAdjustSpeed:
+                ClockFineAdjustSpeed(&clock, &constants, (int8_t)argument);
+                break;
+            
+            case EventResetSpeedAdjust:
+                if (argument & 0x8000)
+                {
+                    clock.is_averaging_tempo ^= 1;
+                    lfo.is_averaging_tempo ^= 1;
+                }
+                else
+                {
+                    clock.tempo_adjust_offset = 0;
+                    clock.tempo_fine_trim = 0;
+                    ClockRecalculateTempo(&clock, &constants);
+                }
+                break;
+            
+            case EventClearAverage:
+                TapTempoClearAverage(&clock.tap_tempo);
+                break;
+            
+            case EventSyncInterval:
+                LfoSetBaseTempo(&lfo, &constants, argument & 0x3fff, 1);
+                break;
+            
+            case EventSetRatio:
+                LfoSetRatio(&lfo, argument);
+                break;
+            
+            case EventSetBasePhase:
+                lfo.base_phase = ((uint32_t)argument << 16) | argument;
+                break;
+            
+            case EventBaseWrap:
+                LfoBaseWrap(&lfo);
+                break;
+            
+            case EventSkipBeats:
+                TempoSkipAlignmentBeats(&lfo.alignment, argument % RATIO_MAX);
+                break;
+            
+            case EventResetAlignment:
+                TempoResetAlignment(&lfo.alignment);
+                lfo.base_phase = 0;
+                break;
+        }
+        
+        CheckClock(&clock, &constants);
+        CheckLfo(&lfo, &constants);
+    }
+    
+    return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+
+int main(int argc, char *argv[])
+{
+    //
+    // Without libFuzzer: run each file named on the command line once, or
+    // else a number of random inputs (default 10000) from a fixed seed.
+    //
+    
+    static uint8_t data[4096];
+    
+    if ((argc > 1) && (atol(argv[1]) == 0))
+    {
+        int i;
+        
+        for (i = 1; i < argc; i++)
+        {
+            FILE *file = fopen(argv[i], "rb");
+            size_t size;
+            
+            if (file == NULL)
+            {
+                perror(argv[i]);
+                return 1;
+            }
+            
+            size = fread(data, 1, sizeof(data), file);
+            fclose(file);
+            
+            LLVMFuzzerTestOneInput(data, size);
+        }
+    }
+    else
+    {
+        long runs = (argc > 1) ? atol(argv[1]) : 10000;
+        uint32_t seed = 0x2545f491UL;
+        long run;
+        
+        for (run = 0; run < runs; run++)
+        {
+            size_t size = 0;
+            size_t i;
+            
+            for (i = 0; i < sizeof(data); i++)
+            {
+                seed ^= seed << 13;
+                seed ^= seed >> 17;
+                seed ^= seed << 5;
+                
+                if (i == 0)
+                {
+                    size = seed % sizeof(data);
+                }
+                
+                data[i] = seed >> 24;
+            }
+            
+            LLVMFuzzerTestOneInput(data, size);
+        }
+        
+        printf("fuzz_taptempo: %ld inputs, no invariant broken\n", runs);
+    }
+    
+    return 0;
+}
+
+#endif
+
+/*====== Local functions ====================================================== 
+=============================================================================*/
+
+static void Check(int condition, const char *text, int line)
+{
+    if (!condition)
+    {
+        fprintf(stderr, "fuzz_taptempo.c:%d: invariant broken: %s\n", line, text);
+        abort();
+    }
+}
+
+static void CheckTracker(const TapTempo *tap_tempo)
+{
+    uint32_t sum = 0;
+    uint8_t i;
+    
+    CHECK(tap_tempo->interval_count <= TAPTEMPO_AVERAGE_MAX_COUNT);
+    CHECK(tap_tempo->interval_index < TAPTEMPO_AVERAGE_MAX_COUNT);
+    
+    //
+    // The running sum matches the stored intervals, and the tempo is their
+    // average.
+    //
+    
+    for (i = 0; i < tap_tempo->interval_count; i++)
+    {
+        CHECK(tap_tempo->interval[i] >= tap_tempo->min_interval);
+        CHECK(tap_tempo->interval[i] <= tap_tempo->max_interval);
+        
+        sum += tap_tempo->interval[i];
+    }
+    
+    CHECK(tap_tempo->interval_sum == sum);
+    CHECK((tap_tempo->interval_count == 0) || (tap_tempo->tempo == (sum / tap_tempo->interval_count)));
+    CHECK((tap_tempo->is_changing == 0) || (tap_tempo->interval_count > 0));
+    
+    //
+    // No tempo yet, or one within the limits.
+    //
+    
+    CHECK((tap_tempo->tempo == 0) || (tap_tempo->tempo >= tap_tempo->min_interval));
+    CHECK(tap_tempo->tempo <= tap_tempo->max_interval);
+}
+
+static void CheckClock(const Clock *clock, const Constants *constants)
+{
+    int32_t tempo = (int32_t)clock->base_tempo + clock->tempo_adjust_offset;
+    
+    CheckTracker(&clock->tap_tempo);
+    
+    CHECK(TempoIsWithinLimits(clock->base_tempo, LFO_MAX_TEMPO, LFO_MIN_TEMPO));
+    CHECK(TempoIsWithinLimits(tempo, LFO_MAX_TEMPO, LFO_MIN_TEMPO));
+    CHECK((clock->base_duty_cycle >= constants->duty_cycle_min) && (clock->base_duty_cycle <= constants->duty_cycle_max));
+    
+    //
+    // The fine trim stays within its range, and without one the duty cycle is
+    // exactly the tempo's (within the limits).
+    //
+    
+    CHECK((clock->tempo_fine_trim >= -TEMPO_TRIM_MAX) && (clock->tempo_fine_trim <= TEMPO_TRIM_MAX));
+    CHECK((clock->tempo_fine_trim != 0) ||
+          (clock->base_duty_cycle == TempoTrimDutyCycle(CalcBaseDutyCycle(constants, tempo), 0, constants->duty_cycle_min, constants->duty_cycle_max)));
+    
+    //
+    // Tempo counting always ends, with a tap or the timeout.
+    //
+    
+    CHECK((clock->is_counting_tempo == 0) || (clock->tempo_ms_count <= LFO_MIN_TEMPO));
+    CHECK((clock->is_counting_tempo == 1) || (clock->tempo_ms_count == 0));
+}
+
+static void CheckLfo(const Lfo *lfo, const Constants *constants)
+{
+    CheckTracker(&lfo->tap_tempo);
+    
+    CHECK(TempoIsWithinLimits(lfo->base_tempo, LFO_MAX_TEMPO, LFO_MIN_TEMPO));
+    CHECK(lfo->base_duty_cycle == CalcBaseDutyCycle(constants, lfo->base_tempo));
+    CHECK(lfo->base_duty_cycle >= CalcBaseDutyCycle(constants, LFO_MIN_TEMPO));
+    CHECK(lfo->base_duty_cycle <= CalcBaseDutyCycle(constants, LFO_MAX_TEMPO));
+    
+    CheckAlignment(&lfo->alignment, lfo->base_phase);
+}
+
+static void CheckAlignment(const TempoAlignment *alignment, uint32_t base_phase)
+{
+    uint8_t period = alignment->base_period;
+    uint8_t i;
+    
+    for (i = 0; i < TEMPO_ALIGNMENT_OUTPUTS; i++)
+    {
+        const TempoRatio *ratio = &alignment->output[i];
+        uint8_t divisor = CalcGreatestCommonDivisor(period, ratio->alignment_period);
+        
+        //
+        // Each output's period is its reduced denominator, its beat follows
+        // the common index, and its phase is where it would be had it been
+        // running at its ratio since it last lined up with the base tempo.
+        //
+        
+        CHECK((ratio->numerator >= 1) && (ratio->denominator >= 1));
+        CHECK(ratio->alignment_period == (ratio->denominator / CalcGreatestCommonDivisor(ratio->numerator, ratio->denominator)));
+        CHECK(ratio->alignment_beat < ratio->alignment_period);
+        CHECK(ratio->alignment_beat == (alignment->index % ratio->alignment_period));
+        CHECK(TempoCalcPhase(alignment, i, base_phase) == CalcReferencePhase(ratio, base_phase));
+        
+        period = (period / divisor) * ratio->alignment_period;
+    }
+    
+    //
+    // The common period is the least common multiple of them all, and the
+    // index stays within it.
+    //
+    
+    CHECK(alignment->period == period);
+    CHECK(alignment->index < alignment->period);
+}
+
+static uint32_t CalcReferencePhase(const TempoRatio *ratio, uint32_t base_phase)
+{
+    //
+    // (previous beat + base phase) * N / M cycles in 64 bits, the base phase
+    // taken at 24 bits like the firmware does.
+    //
+    
+    uint64_t beat = (ratio->alignment_beat == 0) ? (ratio->alignment_period - 1) : (ratio->alignment_beat - 1);
+    uint64_t phase = (((beat << 24) + (base_phase >> 8)) * ratio->numerator) / ratio->denominator;
+    
+    return (uint32_t)(phase << 8);
+}
+
+static uint8_t CalcGreatestCommonDivisor(uint8_t a, uint8_t b)
+{
+    while (b != 0)
+    {
+        uint8_t remainder = a % b;
+        
+        a = b;
+        b = remainder;
+    }
+    
+    return a;
+}
+
+static void LoadConstants(Constants *constants, const Build *build)
+{
+    constants->build = build;
+    constants->duty_cycle_dividend = TEMPO_DUTY_CYCLE_DIVIDEND(build->clock, build->period);
+    constants->duty_cycle_min = constants->duty_cycle_dividend / LFO_MIN_TEMPO;
+    constants->duty_cycle_max = constants->duty_cycle_dividend / LFO_MAX_TEMPO;
+    constants->quantize_dividend = 0;
+    constants->step_duty_cycle = 0;
+    
+    if (build->quantize > 0)
+    {
+        constants->quantize_dividend = TEMPO_BPM_QUANTIZE_DIVIDEND(build->quantize);
+        constants->step_duty_cycle = TEMPO_BPM_STEP_DUTY_CYCLE(build->clock, build->period, build->quantize);
+    }
+}
+
+static uint32_t CalcBaseDutyCycle(const Constants *constants, uint16_t tempo)
+{
+    if (constants->build->quantize > 0)
+    {
+        return TempoCalcQuantizedDutyCycle(constants->quantize_dividend, constants->step_duty_cycle, tempo);
+    }
+    
+    return TempoCalcDutyCycle(constants->duty_cycle_dividend, tempo);
+}
+
+static void ClockInitialize(Clock *clock, const Constants *constants)
+{
+    TapTempoInitialize(&clock->tap_tempo, LFO_MAX_TEMPO, LFO_MIN_TEMPO);
+    
+    clock->base_tempo = 0;
+    clock->tempo_adjust_offset = 0;
+    clock->tempo_fine_trim = 0;
+    clock->base_duty_cycle = 0;
+    clock->is_counting_tempo = 0;
+    clock->is_averaging_tempo = 1;
+    clock->tempo_ms_count = 0;
+    
+    ClockSetBaseTempo(clock, constants, DEFAULT_TEMPO);
+}
+
+static void ClockSetBaseTempo(Clock *clock, const Constants *constants, uint16_t milliseconds)
+{
+    if (!TempoIsWithinLimits(milliseconds, LFO_MAX_TEMPO, LFO_MIN_TEMPO))
+    {
+        return;
+    }
+    
+    if (clock->is_averaging_tempo == 1)
+    {
+        milliseconds = TapTempoAddInterval(&clock->tap_tempo, milliseconds);
+    }
+    
+    if (TempoIsChange(clock->base_tempo, milliseconds))
+    {
+        clock->base_tempo = milliseconds;
+        clock->tempo_adjust_offset = 0;
+        
+        ClockRecalculateTempo(clock, constants);
+    }
+}
+
+static void ClockTick(Clock *clock, uint16_t milliseconds)
+{
+    //
+    // The firmware counts a millisecond at a time and times out as soon as the
+    // count passes LFO_MIN_TEMPO; the same, in one go.
+    //
+    
+    if (clock->is_counting_tempo == 1)
+    {
+        if (((uint32_t)clock->tempo_ms_count + milliseconds) > LFO_MIN_TEMPO)
+        {
+            clock->is_counting_tempo = 0;
+            clock->tempo_ms_count = 0;
+        }
+        else
+        {
+            clock->tempo_ms_count += milliseconds;
+        }
+    }
+}
+
+static void ClockTap(Clock *clock, const Constants *constants)
+{
+    if (clock->is_counting_tempo == 0)
+    {
+        clock->tempo_ms_count = 0;
+        clock->is_counting_tempo = 1;
+    }
+    else
+    {
+        clock->is_counting_tempo = 0;
+        
+        ClockSetBaseTempo(clock, constants, clock->tempo_ms_count);
+        clock->tempo_ms_count = 0;
+    }
+}
+
+static void ClockAdjustSpeed(Clock *clock, const Constants *constants, int16_t change_value)
+{
+    if (!TempoIsWithinLimits((int32_t)clock->base_tempo + clock->tempo_adjust_offset + change_value, LFO_MAX_TEMPO, LFO_MIN_TEMPO))
+    {
+        return;
+    }
+    
+    clock->tempo_adjust_offset += change_value;
+    ClockRecalculateTempo(clock, constants);
+}
+
+static void ClockFineAdjustSpeed(Clock *clock, const Constants *constants, int8_t change_value)
+{
+    uint16_t tempo = clock->base_tempo + clock->tempo_adjust_offset;
+    int16_t trim = clock->tempo_fine_trim;
+    uint32_t duty_cycle;
+    
+    if (tempo >= TEMPO_TRIM_SLOWEST)
+    {
+        ClockAdjustSpeed(clock, constants, change_value);
+        return;
+    }
+    
+    duty_cycle = TempoStepTrim(CalcBaseDutyCycle(constants, tempo), &trim, change_value, constants->duty_cycle_min, constants->duty_cycle_max);
+    
+    if (duty_cycle != 0)
+    {
+        clock->tempo_fine_trim = trim;
+        clock->base_duty_cycle = duty_cycle;
+    }
+    else
+    {
+        CHECK(trim == clock->tempo_fine_trim);
+    }
+}
+
+static void ClockRecalculateTempo(Clock *clock, const Constants *constants)
+{
+    uint16_t tempo = clock->base_tempo + clock->tempo_adjust_offset;
+    
+    clock->base_duty_cycle = TempoTrimDutyCycle(CalcBaseDutyCycle(constants, tempo), clock->tempo_fine_trim, constants->duty_cycle_min, constants->duty_cycle_max);
+}
+
+static void LfoInitialize(Lfo *lfo, const Constants *constants)
+{
+    TempoAlignment alignment = TEMPO_ALIGNMENT_INIT(constants->build->alignment_base_period);
+    
+    TapTempoInitialize(&lfo->tap_tempo, LFO_MAX_TEMPO, LFO_MIN_TEMPO);
+    
+    lfo->base_tempo = 0;
+    lfo->base_duty_cycle = 0;
+    lfo->is_averaging_tempo = 0;
+    lfo->alignment = alignment;
+    lfo->base_phase = 0;
+    
+    LfoSetBaseTempo(lfo, constants, DEFAULT_TEMPO, 0);
+}
+
+static void LfoSetBaseTempo(Lfo *lfo, const Constants *constants, uint16_t milliseconds, uint8_t is_sync_tempo)
+{
+    //
+    // Without TAP_AVERAGING, and for sync input, the tracker starts afresh
+    // every time and hands the interval straight back.
+    //
+    
+    if ((lfo->is_averaging_tempo == 0) || (is_sync_tempo == 1))
+    {
+        TapTempoInitialize(&lfo->tap_tempo, LFO_MAX_TEMPO, LFO_MIN_TEMPO);
+    }
+    
+    milliseconds = TapTempoAddInterval(&lfo->tap_tempo, milliseconds);
+    
+    if (milliseconds == 0)
+    {
+        return;
+    }
+    
+    if (TempoIsChange(lfo->base_tempo, milliseconds))
+    {
+        lfo->base_tempo = milliseconds;
+        lfo->base_duty_cycle = CalcBaseDutyCycle(constants, milliseconds);
+    }
+}
+
+static void LfoSetRatio(Lfo *lfo, uint16_t argument)
+{
+    uint8_t output = argument & 0x01;
+    uint8_t numerator = ((argument >> 1) % RATIO_MAX) + 1;
+    uint8_t denominator = ((argument >> 8) % RATIO_MAX) + 1;
+    
+    //
+    // The attiny85 has a single output, and its multipliers all line up
+    // within its alignment span (whole notes every 4/4, dotted notes every
+    // 3/4 and so on); the attiny84a takes any N/M up to RATIO_MAX on either.
+    //
+    
+    if (lfo->alignment.base_period == MULTIPLIER_ALIGNMENT_OFFSET)
+    {
+        output = 0;
+        numerator = ((argument >> 1) % 8) + 1;
+        denominator = ((argument >> 8) % 4) + 1;
+    }
+    
+    TempoSetRatio(&lfo->alignment, output, numerator, denominator);
+}
+
+static void LfoBaseWrap(Lfo *lfo)
+{
+    uint32_t before[TEMPO_ALIGNMENT_OUTPUTS];
+    uint8_t is_aligned;
+    uint8_t i;
+    
+    //
+    // A beat right on time: the base tempo comes round (or is reset by a tap
+    // or sync edge at the very end of its cycle) and the outputs are aligned.
+    // Each output's phase carries on across it, within a step, whether it
+    // lines up with the base tempo on this beat (and is reset to 0) or not.
+    //
+    
+    for (i = 0; i < TEMPO_ALIGNMENT_OUTPUTS; i++)
+    {
+        before[i] = TempoCalcPhase(&lfo->alignment, i, 0xffffffffUL);
+    }
+    
+    is_aligned = TempoStepAlignment(&lfo->alignment);
+    lfo->base_phase = 0;
+    
+    for (i = 0; i < TEMPO_ALIGNMENT_OUTPUTS; i++)
+    {
+        uint32_t after = TempoCalcPhase(&lfo->alignment, i, 0);
+        
+        CHECK(((is_aligned >> i) & 0x01) == (after == 0));
+        CHECK((uint32_t)(after - before[i]) <= BEAT_PHASE_TOLERANCE);
+    }
+}
@@ -0,0 +1,304 @@
+//
+// Tap-tempo tracking library.
+// 
+// Copyright (C) 2013-2016 Harald Sabro
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Contact info
+// ------------
+// Website: sabrotone.com
+// Email: harald (AT) website 
+//
+
+
+#include <stdint.h>
+
+#include "taptempo.h"
+
+//
+// An interval this far off the current tempo (as a fraction of it, 1024 =
+// 100%) counts as no agreement at all when working out the confidence; 256 is
+// 25%.
+//
+
+#define CONFIDENCE_DEVIATION_SCALE      1024
+
+//
+// Local function prototypes.
+//
+
+static void UpdateConfidence(TapTempo *tap_tempo, uint16_t interval);
+static uint8_t IsTempoChange(uint16_t interval, uint16_t tempo);
+static void AddToAverage(TapTempo *tap_tempo, uint16_t interval);
+static uint16_t CalculateBeatPhase(uint32_t elapsed, uint16_t tempo);
+static TapTempoResult PushTimestamp(TapTempo *tap_tempo, uint32_t timestamp);
+
+/*====== Public functions ===================================================== 
+=============================================================================*/
+
+void TapTempoInitialize(TapTempo *tap_tempo, uint16_t min_interval, uint16_t max_interval)
+{
+    tap_tempo->min_interval = min_interval;
+    tap_tempo->max_interval = max_interval;
+    tap_tempo->previous_tap = 0;
+    tap_tempo->is_counting = 0;
+    tap_tempo->confidence = 0;
+    tap_tempo->tempo = 0;
+    
+    TapTempoClearAverage(tap_tempo);
+}
+
+void TapTempoClearAverage(TapTempo *tap_tempo)
+{
+    //
+    // Forget the stored intervals; the next one starts a fresh average. The
+    // current tempo is kept until then.
+    //
+    
+    tap_tempo->interval_count = 0;
+    tap_tempo->interval_index = 0;
+    tap_tempo->interval_sum = 0;
+    tap_tempo->is_changing = 0;
+}
+
+uint16_t TapTempoAddInterval(TapTempo *tap_tempo, uint16_t interval)
+{
+    //
+    // Anything outside the accepted range is rejected outright, leaving the
+    // state untouched.
+    //
+    
+    if ((interval < tap_tempo->min_interval) || (interval > tap_tempo->max_interval))
+    {
+        return 0;
+    }
+    
+    UpdateConfidence(tap_tempo, interval);
+    
+    //
+    // Look out for a deliberate tempo change (see TAPTEMPO_CHANGE_THRESHOLD);
+    // otherwise it would take a full window of taps to average the old tempo
+    // out. Only once there's an average to be off from.
+    //
+    
+    if ((tap_tempo->interval_count > 0) && IsTempoChange(interval, tap_tempo->tempo))
+    {
+        if ((tap_tempo->is_changing == 1) && !IsTempoChange(interval, tap_tempo->change_interval))
+        {
+            //
+            // Second interval in a row off the tempo, and in agreement with
+            // the first. Start the average over from the two of them.
+            //
+            
+            uint16_t change_interval = tap_tempo->change_interval;
+            
+            TapTempoClearAverage(tap_tempo);
+            AddToAverage(tap_tempo, change_interval);
+            AddToAverage(tap_tempo, interval);
+            
+            tap_tempo->confidence = 0;
+        }
+        else
+        {
+            //
+            // Hold it back until the next interval tells whether it was a
+            // change or a stray tap. The tempo stays as it is meanwhile.
+            //
+            
+            tap_tempo->is_changing = 1;
+            tap_tempo->change_interval = interval;
+        }
+        
+        return tap_tempo->tempo;
+    }
+    
+    tap_tempo->is_changing = 0;
+    AddToAverage(tap_tempo, interval);
+    
+    return tap_tempo->tempo;
+}
+
+TapTempoResult TapTempoPush(TapTempo *tap_tempo, uint32_t timestamp)
+{
+    return PushTimestamp(tap_tempo, timestamp);
+}
+
+uint32_t TapTempoPushArray(TapTempo *tap_tempo, const uint32_t *timestamps, TapTempoResult *results, uint32_t count)
+{
+    uint32_t i;
+    
+    for (i = 0; i < count; i++)
+    {
+        results[i] = PushTimestamp(tap_tempo, timestamps[i]);
+    }
+    
+    return count;
+}
+
+uint16_t TapTempoGetPhase(const TapTempo *tap_tempo, uint32_t timestamp)
+{
+    //
+    // Position within the current beat, counting from the last tap.
+    //
+    
+    if ((tap_tempo->is_counting == 0) || (tap_tempo->tempo == 0))
+    {
+        return 0;
+    }
+    
+    return CalculateBeatPhase(timestamp - tap_tempo->previous_tap, tap_tempo->tempo);
+}
+
+/*====== Local functions ====================================================== 
+=============================================================================*/
+
+static uint8_t IsTempoChange(uint16_t interval, uint16_t tempo)
+{
+    uint16_t deviation = (interval > tempo) ? (interval - tempo) : (tempo - interval);
+    
+    return (((uint32_t)deviation * CONFIDENCE_DEVIATION_SCALE) > ((uint32_t)tempo * TAPTEMPO_CHANGE_THRESHOLD)) ? 1 : 0;
+}
+
+static void AddToAverage(TapTempo *tap_tempo, uint16_t interval)
+{
+    //
+    // Store the interval in the ring, overwriting the oldest one once it's
+    // full. The sum is kept running alongside, so the average costs one
+    // division no matter how many intervals it covers (and at 32 bits it
+    // can't overflow, even with every slot at the maximum interval).
+    //
+    
+    if (tap_tempo->interval_count < TAPTEMPO_AVERAGE_MAX_COUNT)
+    {
+        tap_tempo->interval_count++;
+    }
+    else
+    {
+        tap_tempo->interval_sum -= tap_tempo->interval[tap_tempo->interval_index];
+    }
+    
+    tap_tempo->interval[tap_tempo->interval_index] = interval;
+    tap_tempo->interval_sum += interval;
+    
+    tap_tempo->interval_index++;
+    if (tap_tempo->interval_index >= TAPTEMPO_AVERAGE_MAX_COUNT)
+    {
+        tap_tempo->interval_index = 0;
+    }
+    
+    //
+    // A single interval is its own average; the firmware starts every interval
+    // afresh when it isn't averaging, and that way doesn't pay for a 32-bit
+    // division.
+    //
+    
+    if (tap_tempo->interval_count == 1)
+    {
+        tap_tempo->tempo = interval;
+    }
+    else
+    {
+        tap_tempo->tempo = tap_tempo->interval_sum / tap_tempo->interval_count;
+    }
+}
+
+static void UpdateConfidence(TapTempo *tap_tempo, uint16_t interval)
+{
+    uint16_t deviation;
+    uint32_t disagreement;
+    uint8_t agreement;
+    
+    //
+    // Nothing to compare the first interval against.
+    //
+    
+    if (tap_tempo->tempo == 0)
+    {
+        tap_tempo->confidence = 0;
+        return;
+    }
+    
+    //
+    // Score how well this interval agrees with the tempo so far (255 = spot
+    // on, 0 = a quarter or more off), then blend it into the confidence a
+    // quarter at a time. Steady tapping climbs to 255 over a handful of taps,
+    // a single stray tap only knocks it down a bit. Rounding up lets it
+    // actually reach 255.
+    //
+    
+    deviation = (interval > tap_tempo->tempo) ? (interval - tap_tempo->tempo) : (tap_tempo->tempo - interval);
+    disagreement = ((uint32_t)deviation * CONFIDENCE_DEVIATION_SCALE) / tap_tempo->tempo;
+    agreement = (disagreement >= 255) ? 0 : (255 - disagreement);
+    
+    tap_tempo->confidence = (((uint16_t)tap_tempo->confidence * 3) + agreement + 3) / 4;
+}
+
+static uint16_t CalculateBeatPhase(uint32_t elapsed, uint16_t tempo)
+{
+    return ((elapsed % tempo) << 16) / tempo;
+}
+
+static TapTempoResult PushTimestamp(TapTempo *tap_tempo, uint32_t timestamp)
+{
+    TapTempoResult result;
+    
+    //
+    // Unsigned difference, so a wrapping timestamp counter is fine.
+    //
+    
+    uint32_t elapsed = timestamp - tap_tempo->previous_tap;
+    
+    result.phase = 0;
+    
+    if ((tap_tempo->is_counting == 1) && (elapsed < tap_tempo->min_interval))
+    {
+        //
+        // Too soon after the previous tap to be a new one; contact bounce or a
+        // double trigger. Ignore it completely.
+        //
+    }
+    else if ((tap_tempo->is_counting == 0) || (elapsed > tap_tempo->max_interval))
+    {
+        //
+        // First tap, or the first after a gap too long to be an interval.
+        // Start measuring from here. The tempo is kept, but the taps leading
+        // up to it no longer say anything about how steady the next ones are.
+        //
+        
+        tap_tempo->is_counting = 1;
+        tap_tempo->previous_tap = timestamp;
+        tap_tempo->confidence = 0;
+    }
+    else
+    {
+        //
+        // Where the tap fell relative to the beat is worked out against the
+        // tempo before this interval is added.
+        //
+        
+        if (tap_tempo->tempo != 0)
+        {
+            result.phase = CalculateBeatPhase(elapsed, tap_tempo->tempo);
+        }
+        
+        tap_tempo->previous_tap = timestamp;
+        TapTempoAddInterval(tap_tempo, elapsed);
+    }
+    
+    result.tempo = tap_tempo->tempo;
+    result.confidence = tap_tempo->confidence;
+    
+    return result;
+}
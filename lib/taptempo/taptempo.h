@@ -0,0 +1,108 @@
+//
+// Tap-tempo tracking library.
+// 
+// Copyright (C) 2013-2016 Harald Sabro
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Contact info
+// ------------
+// Website: sabrotone.com
+// Email: harald (AT) website 
+//
+
+
+#ifndef __TAPTEMPO_H__
+#define __TAPTEMPO_H__
+
+#include <stdint.h>
+
+//
+// Tap interval tracking shared by the firmware and host side tools. Plain C99,
+// no heap, no floating point and no hardware dependencies; all state lives in
+// one fixed size TapTempo struct owned by the caller.
+//
+// Two ways in:
+//
+// - TapTempoPush() takes tap timestamps (milliseconds, any free running
+//   32-bit counter; wrap around is fine) and returns tempo, phase and
+//   confidence. Every tap ends one interval and starts the next.
+//   TapTempoPushArray() does the same for a whole array of timestamps, for
+//   offline analysis.
+//
+// - TapTempoAddInterval() takes an already measured interval. This is what
+//   the firmware uses, as it counts the milliseconds between taps itself.
+//
+// Every operation is O(1) per tap.
+//
+
+//
+// Number of intervals kept for the running average.
+//
+
+#define TAPTEMPO_AVERAGE_MAX_COUNT      10
+
+//
+// An interval further off the current tempo than this (as a fraction of it,
+// 1024 = 100%; 128 is 12.5%) is taken as a possible tempo change rather than
+// tapping jitter. It's held out of the average, and if the next interval is
+// off too, and agrees with it, the average restarts from those two. A single
+// stray tap is dropped.
+//
+
+#define TAPTEMPO_CHANGE_THRESHOLD       128
+
+//
+// Tracker state. Treat as opaque; set up with TapTempoInitialize().
+//
+
+typedef struct
+{
+    uint16_t min_interval;      // Shortest accepted interval (ms); shorter taps are ignored as bounces.
+    uint16_t max_interval;      // Longest accepted interval (ms); longer gaps restart the tracking.
+    uint32_t previous_tap;      // Timestamp of the previous tap (TapTempoPush() only).
+    uint8_t is_counting;        // Set once there is a previous tap to measure from.
+    uint8_t interval_count;     // Intervals in the average, up to TAPTEMPO_AVERAGE_MAX_COUNT.
+    uint8_t interval_index;     // Next slot to overwrite.
+    uint8_t confidence;         // See TapTempoResult.
+    uint8_t is_changing;        // Set while change_interval waits for a second interval to confirm it.
+    uint16_t change_interval;   // Interval that looked like a tempo change (see TAPTEMPO_CHANGE_THRESHOLD).
+    uint32_t interval_sum;      // Running sum of the intervals in the average.
+    uint16_t interval[TAPTEMPO_AVERAGE_MAX_COUNT];
+    uint16_t tempo;             // Current tempo (ms per beat), 0 until the first interval.
+} TapTempo;
+
+typedef struct
+{
+    uint16_t tempo;             // Milliseconds per beat, 0 until the first interval.
+    uint16_t phase;             // Where the tap landed on the previous tempo's beat grid, in 1/65536 beats.
+                                // 0 is on the beat, just above 0 is late, just below 65536 is early.
+    uint8_t confidence;         // How steady the recent taps have been, 0 (none) - 255 (all agree).
+} TapTempoResult;
+
+//
+// Public function prototypes.
+//
+
+void TapTempoInitialize(TapTempo *tap_tempo, uint16_t min_interval, uint16_t max_interval);
+void TapTempoClearAverage(TapTempo *tap_tempo);
+
+uint16_t TapTempoAddInterval(TapTempo *tap_tempo, uint16_t interval);
+
+TapTempoResult TapTempoPush(TapTempo *tap_tempo, uint32_t timestamp);
+uint32_t TapTempoPushArray(TapTempo *tap_tempo, const uint32_t *timestamps, TapTempoResult *results, uint32_t count);
+
+uint16_t TapTempoGetPhase(const TapTempo *tap_tempo, uint32_t timestamp);
+
+#endif // __TAPTEMPO_H__
@@ -0,0 +1,291 @@
+//
+// Tempo arithmetic library.
+// 
+// Copyright (C) 2013-2016 Harald Sabro
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Contact info
+// ------------
+// Website: sabrotone.com
+// Email: harald (AT) website 
+//
+
+#include <stdint.h>
+
+#include "tempo.h"
+
+//
+// Local function prototypes.
+//
+
+static uint8_t CalcGreatestCommonDivisor(uint8_t a, uint8_t b);
+static uint8_t CalcLeastCommonMultiple(uint8_t a, uint8_t b);
+
+/*====== Public functions ===================================================== 
+=============================================================================*/
+
+uint8_t TempoIsWithinLimits(int32_t tempo, uint16_t max_tempo, uint16_t min_tempo)
+{
+    //
+    // The tempo limits are in milliseconds, so the fastest tempo (max_tempo)
+    // is the smaller number. Signed and 32 bits wide, so the sum of an
+    // unsigned base tempo and signed offsets can be passed in as it is.
+    //
+    
+    return (tempo >= max_tempo) && (tempo <= min_tempo);
+}
+
+uint8_t TempoIsChange(uint16_t tempo, uint16_t milliseconds)
+{
+    //
+    // No need to recalculate if the new tempo count is just a few milliseconds
+    // off (would be typical when running off an external clock pulse).
+    //
+    // 2ms +/- seems to eliminate any syncing irregularities when clocked from
+    // an external tap-tempo chip.
+    //
+    // The difference is taken from the larger value so neither side can wrap
+    // around.
+    //
+    
+    uint16_t tempo_difference = (tempo > milliseconds) ?
+        (tempo - milliseconds) : (milliseconds - tempo);
+    
+    return tempo_difference > TEMPO_CHANGE_TOLERANCE;
+}
+
+uint32_t TempoCalcDutyCycle(uint32_t dividend, uint16_t tempo)
+{
+    //
+    // The duty cycle for the tempo (see TEMPO_DUTY_CYCLE_DIVIDEND), rounded
+    // to the nearest step.
+    //
+    
+    return (dividend + (tempo / 2)) / tempo;
+}
+
+uint32_t TempoCalcQuantizedDutyCycle(uint32_t quantize_dividend, uint32_t step_duty_cycle, uint16_t tempo)
+{
+    //
+    // Snap to the nearest quantize step per minute (see
+    // TEMPO_BPM_QUANTIZE_DIVIDEND), and go straight from there to the duty
+    // cycle, rounded to the nearest step. The multiplication is split in whole
+    // and fractional parts to stay within 32 bits.
+    //
+    
+    uint32_t steps = (quantize_dividend + (tempo / 2)) / tempo;
+    
+    return (steps * (step_duty_cycle >> 16)) + (((steps * (step_duty_cycle & 0xffff)) + 0x8000) >> 16);
+}
+
+uint32_t TempoTrimDutyCycle(uint32_t duty_cycle, int16_t trim, uint32_t min_duty_cycle, uint32_t max_duty_cycle)
+{
+    //
+    // Apply a fine speed trim (see TEMPO_TRIM_SHIFT), positive slowing down;
+    // a shift and a multiply, no division. The step fits 32 bits as long as
+    // the trim is within TEMPO_TRIM_MAX. The result is kept within the
+    // limits.
+    //
+    
+    uint32_t step = (duty_cycle >> TEMPO_TRIM_SHIFT) * (uint16_t)((trim < 0) ? -trim : trim);
+    
+    if (trim > 0)
+    {
+        return (duty_cycle > (min_duty_cycle + step)) ? (duty_cycle - step) : min_duty_cycle;
+    }
+    
+    duty_cycle += step;
+    
+    return (duty_cycle < max_duty_cycle) ? duty_cycle : max_duty_cycle;
+}
+
+uint32_t TempoStepTrim(uint32_t duty_cycle, int16_t *trim, int8_t change_value, uint32_t min_duty_cycle, uint32_t max_duty_cycle)
+{
+    //
+    // Step the trim and return the untrimmed duty cycle with the new trim
+    // applied. A step that would take the trim past TEMPO_TRIM_MAX, or the
+    // duty cycle to either limit, is left out; the trim stays as it was and 0
+    // is returned.
+    //
+    
+    int16_t new_trim = *trim + change_value;
+    
+    if ((new_trim > TEMPO_TRIM_MAX) || (new_trim < -TEMPO_TRIM_MAX))
+    {
+        return 0;
+    }
+    
+    duty_cycle = TempoTrimDutyCycle(duty_cycle, new_trim, min_duty_cycle, max_duty_cycle);
+    
+    if ((duty_cycle <= min_duty_cycle) || (duty_cycle >= max_duty_cycle))
+    {
+        return 0;
+    }
+    
+    *trim = new_trim;
+    
+    return duty_cycle;
+}
+
+void TempoSetRatio(volatile TempoAlignment *alignment, uint8_t output, uint8_t numerator, uint8_t denominator)
+{
+    volatile TempoRatio *ratio = &alignment->output[output];
+    uint8_t period = alignment->base_period;
+    uint8_t i;
+    
+    ratio->numerator = numerator;
+    ratio->denominator = denominator;
+    ratio->alignment_period = denominator / CalcGreatestCommonDivisor(numerator, denominator);
+    
+    //
+    // Work the common period out once here, then bring each output's count
+    // within its own period in line with the count within the common one.
+    //
+    
+    for (i = 0; i < TEMPO_ALIGNMENT_OUTPUTS; i++)
+    {
+        period = CalcLeastCommonMultiple(period, alignment->output[i].alignment_period);
+    }
+    
+    alignment->period = period;
+    
+    TempoSetAlignmentIndex(alignment, alignment->index);
+}
+
+void TempoSetAlignmentIndex(volatile TempoAlignment *alignment, uint8_t index)
+{
+    uint8_t i;
+    
+    alignment->index = index % alignment->period;
+    
+    for (i = 0; i < TEMPO_ALIGNMENT_OUTPUTS; i++)
+    {
+        alignment->output[i].alignment_beat = alignment->index % alignment->output[i].alignment_period;
+    }
+}
+
+void TempoSkipAlignmentBeats(volatile TempoAlignment *alignment, uint8_t beats)
+{
+    //
+    // Move the counts ahead as if TempoStepAlignment() had been called the
+    // given number of times. Worked out in 16 bits, as the index plus the
+    // beats may not fit 8.
+    //
+    
+    if (beats > 0)
+    {
+        TempoSetAlignmentIndex(alignment, ((uint16_t)alignment->index + beats) % alignment->period);
+    }
+}
+
+void TempoResetAlignment(volatile TempoAlignment *alignment)
+{
+    //
+    // The next base tempo cycle starts every period afresh.
+    //
+    
+    TempoSetAlignmentIndex(alignment, 0);
+}
+
+uint8_t TempoStepAlignment(volatile TempoAlignment *alignment)
+{
+    uint8_t is_aligned = 0;
+    uint8_t i;
+    
+    //
+    // Called as a base tempo cycle starts. Returns a bit per output (bit 0 for
+    // output 0) that lines up with the base tempo on this cycle, and should
+    // have its phase reset. Each output keeps count of where it is within its
+    // own period, so this comes down to a compare rather than a division.
+    //
+    
+    for (i = 0; i < TEMPO_ALIGNMENT_OUTPUTS; i++)
+    {
+        volatile TempoRatio *ratio = &alignment->output[i];
+        
+        if (ratio->alignment_beat == 0)
+        {
+            is_aligned |= (1 << i);
+        }
+        
+        if (++ratio->alignment_beat >= ratio->alignment_period)
+        {
+            ratio->alignment_beat = 0;
+        }
+    }
+    
+    if (++alignment->index >= alignment->period)
+    {
+        alignment->index = 0;
+    }
+    
+    return is_aligned;
+}
+
+uint32_t TempoCalcPhase(const volatile TempoAlignment *alignment, uint8_t output, uint32_t base_phase)
+{
+    const volatile TempoRatio *ratio = &alignment->output[output];
+    uint8_t beat;
+    uint32_t phase;
+    
+    //
+    // The phase accumulator an output would have reached at this base phase
+    // had it been running at its ratio from the start, for when the ratio
+    // changes. By doing this the output keeps in sync with the base tempo.
+    //
+    // The output last aligned with the base tempo "beat" base cycles ago, and
+    // has since completed (beat + base phase) * N / M cycles. Only the
+    // fractional part matters, so the whole cycles are dropped using modulo
+    // before anything is multiplied, and the base phase is taken at 24 bits
+    // so that the sum times N still fits 32 bits before dividing by M.
+    //
+    // Note: The alignment beat holds the count of the next base cycle, hence
+    //       one less here.
+    //
+    
+    beat = (ratio->alignment_beat == 0) ? (ratio->alignment_period - 1) : (ratio->alignment_beat - 1);
+    
+    phase = (uint32_t)((beat * ratio->numerator) % ratio->denominator) << 24;
+    phase += (base_phase >> 8) * ratio->numerator;
+    phase /= ratio->denominator;
+    
+    return phase << 8;
+}
+
+/*====== Local functions ====================================================== 
+=============================================================================*/
+
+static uint8_t CalcGreatestCommonDivisor(uint8_t a, uint8_t b)
+{
+    uint8_t remainder;
+    
+    while (b != 0)
+    {
+        remainder = a % b;
+        a = b;
+        b = remainder;
+    }
+    
+    return a;
+}
+
+static uint8_t CalcLeastCommonMultiple(uint8_t a, uint8_t b)
+{
+    //
+    // Divide first, so only the result itself has to fit 8 bits.
+    //
+    
+    return (a / CalcGreatestCommonDivisor(a, b)) * b;
+}
@@ -0,0 +1,147 @@
+//
+// Tempo arithmetic library.
+// 
+// Copyright (C) 2013-2016 Harald Sabro
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Contact info
+// ------------
+// Website: sabrotone.com
+// Email: harald (AT) website 
+//
+
+
+#ifndef __TEMPO_H__
+#define __TEMPO_H__
+
+#include <stdint.h>
+
+//
+// Tempo to duty cycle arithmetic and multiplier alignment, shared by the
+// firmware and the host side tools (see fuzz_taptempo.c) the same way
+// taptempo.c is. Plain C99 with no hardware dependencies; clock rates, PWM
+// periods and tempo limits are passed in by the caller, so the same code
+// serves every chip and build option.
+//
+// The alignment state is volatile, as the firmware keeps it in globals shared
+// with its interrupt handlers; callers see to the atomicity.
+//
+
+//
+// The duty cycle (phase step per sample) for a tempo is
+// 2^32 * frequency / sample rate, with frequency = 1000 / milliseconds and
+// sample rate = clock / period. The constant part, for TempoCalcDutyCycle().
+//
+
+#define TEMPO_DUTY_CYCLE_DIVIDEND(clock, period) \
+    ((uint32_t)((0x100000000ULL * 1000 * (period)) / (clock)))
+
+//
+// BPM quantizing (1 = whole BPM, 2 = half BPM) works from the number of
+// quantize steps per minute instead, times the duty cycle for one step per
+// minute, 2^32 / (60 * quantize * sample rate), in 16.16 fixed point. The
+// constants for TempoCalcQuantizedDutyCycle().
+//
+
+#define TEMPO_BPM_QUANTIZE_DIVIDEND(quantize) \
+    (60000UL * (quantize))
+
+#define TEMPO_BPM_STEP_DUTY_CYCLE(clock, period, quantize) \
+    ((uint32_t)(((0x1000000000000ULL * (period)) + (30ULL * (quantize) * (clock))) / (60ULL * (quantize) * (clock))))
+
+//
+// A new tempo only counts as a change when more than this many milliseconds
+// off the current one (see TempoIsChange()).
+//
+
+#define TEMPO_CHANGE_TOLERANCE          2
+
+//
+// Fine speed trim steps the duty cycle by 1/2^TEMPO_TRIM_SHIFT of itself; 13
+// is 1/8192 of the period, about 122ppm, whatever the tempo. The trim is kept
+// within +/- TEMPO_TRIM_MAX steps (50%). From TEMPO_TRIM_SLOWEST milliseconds
+// and slower a step would be more than a millisecond, and millisecond
+// adjustment is the finer of the two.
+//
+
+#define TEMPO_TRIM_SHIFT                13
+#define TEMPO_TRIM_MAX                  (1 << (TEMPO_TRIM_SHIFT - 1))
+#define TEMPO_TRIM_SLOWEST              (1UL << TEMPO_TRIM_SHIFT)
+
+//
+// Number of multiplied outputs kept in line with the base tempo. A chip with
+// fewer leaves the rest at 1/1.
+//
+
+#define TEMPO_ALIGNMENT_OUTPUTS         2
+
+//
+// An output's N/M ratio to the base tempo, along with its alignment period (M
+// reduced by the greatest common divisor of N and M; the base tempo cycles
+// between each time it lines up with the base tempo) and the base tempo cycle
+// within that period.
+//
+
+typedef struct
+{
+    uint8_t numerator;
+    uint8_t denominator;
+    uint8_t alignment_period;
+    uint8_t alignment_beat;     // Next base tempo cycle to come, 0 - (alignment_period - 1).
+} TempoRatio;
+
+//
+// The outputs all line up every least common multiple of their alignment
+// periods, and of base_period. The index counts base tempo cycles within that
+// common period, and each output's beat follows it (index % alignment
+// period). base_period lets a chip keep counting over a longer span than its
+// current ratios need; 1 if not.
+//
+
+typedef struct
+{
+    uint8_t index;              // Next base tempo cycle to come, 0 - (period - 1).
+    uint8_t period;
+    uint8_t base_period;
+    TempoRatio output[TEMPO_ALIGNMENT_OUTPUTS];
+} TempoAlignment;
+
+//
+// All outputs at 1/1; for static initialization of a TempoAlignment.
+//
+
+#define TEMPO_ALIGNMENT_INIT(base_period) \
+    { 0, (base_period), (base_period), { { 1, 1, 1, 0 }, { 1, 1, 1, 0 } } }
+
+//
+// Public function prototypes.
+//
+
+uint8_t TempoIsWithinLimits(int32_t tempo, uint16_t max_tempo, uint16_t min_tempo);
+uint8_t TempoIsChange(uint16_t tempo, uint16_t milliseconds);
+
+uint32_t TempoCalcDutyCycle(uint32_t dividend, uint16_t tempo);
+uint32_t TempoCalcQuantizedDutyCycle(uint32_t quantize_dividend, uint32_t step_duty_cycle, uint16_t tempo);
+uint32_t TempoTrimDutyCycle(uint32_t duty_cycle, int16_t trim, uint32_t min_duty_cycle, uint32_t max_duty_cycle);
+uint32_t TempoStepTrim(uint32_t duty_cycle, int16_t *trim, int8_t change_value, uint32_t min_duty_cycle, uint32_t max_duty_cycle);
+
+void TempoSetRatio(volatile TempoAlignment *alignment, uint8_t output, uint8_t numerator, uint8_t denominator);
+void TempoSetAlignmentIndex(volatile TempoAlignment *alignment, uint8_t index);
+void TempoSkipAlignmentBeats(volatile TempoAlignment *alignment, uint8_t beats);
+void TempoResetAlignment(volatile TempoAlignment *alignment);
+uint8_t TempoStepAlignment(volatile TempoAlignment *alignment);
+uint32_t TempoCalcPhase(const volatile TempoAlignment *alignment, uint8_t output, uint32_t base_phase);
+
+#endif // __TEMPO_H__
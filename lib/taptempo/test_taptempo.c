@@ -0,0 +1,462 @@
+//
+// Tap-tempo tracking library tests.
+// 
+// Copyright (C) 2013-2016 Harald Sabro
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Contact info
+// ------------
+// Website: sabrotone.com
+// Email: harald (AT) website 
+//
+
+
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "taptempo.h"
+#include "tempo.h"
+
+//
+// Host tests for the tracker and the tempo arithmetic ("make test"). Each
+// tracker test starts from a fresh tracker with the firmware's limits (50ms -
+// 10s); the tempo tests use the 8MHz, 256 cycle PWM period build.
+//
+
+#define MIN_INTERVAL                    50
+#define MAX_INTERVAL                    10000
+
+#define CHECK(condition)                Check((condition), #condition, __LINE__)
+
+//
+// Local function prototypes.
+//
+
+static void Check(int condition, const char *text, int line);
+
+static void TestSteadyTapping();
+static void TestPhase();
+static void TestBounceAndRestart();
+static void TestTimestampWrap();
+static void TestPushArray();
+static void TestRejectedInterval();
+static void TestStrayTap();
+static void TestTempoChange();
+static void TestDutyCycle();
+static void TestFineTrim();
+static void TestAlignment();
+
+static int s_check_count;
+static int s_failure_count;
+
+/*====== Public functions ===================================================== 
+=============================================================================*/
+
+int main()
+{
+    TestSteadyTapping();
+    TestPhase();
+    TestBounceAndRestart();
+    TestTimestampWrap();
+    TestPushArray();
+    TestRejectedInterval();
+    TestStrayTap();
+    TestTempoChange();
+    TestDutyCycle();
+    TestFineTrim();
+    TestAlignment();
+    
+    printf("test_taptempo: %d checks, %d failed\n", s_check_count, s_failure_count);
+    
+    return (s_failure_count == 0) ? 0 : 1;
+}
+
+/*====== Local functions ====================================================== 
+=============================================================================*/
+
+static void Check(int condition, const char *text, int line)
+{
+    s_check_count++;
+    
+    if (!condition)
+    {
+        fprintf(stderr, "test_taptempo.c:%d: check failed: %s\n", line, text);
+        s_failure_count++;
+    }
+}
+
+static void TestSteadyTapping()
+{
+    TapTempo tap_tempo;
+    TapTempoResult result;
+    uint8_t previous_confidence;
+    int i;
+    
+    TapTempoInitialize(&tap_tempo, MIN_INTERVAL, MAX_INTERVAL);
+    
+    //
+    // The first tap only starts the measuring, the second gives a tempo but
+    // nothing yet to be confident about.
+    //
+    
+    result = TapTempoPush(&tap_tempo, 1000);
+    CHECK(result.tempo == 0);
+    CHECK(result.phase == 0);
+    CHECK(result.confidence == 0);
+    
+    result = TapTempoPush(&tap_tempo, 1500);
+    CHECK(result.tempo == 500);
+    CHECK(result.confidence == 0);
+    
+    //
+    // Taps on the beat land at phase 0, and the confidence climbs to 255.
+    //
+    
+    previous_confidence = result.confidence;
+    
+    for (i = 2; i < 20; i++)
+    {
+        result = TapTempoPush(&tap_tempo, 1000 + (i * 500));
+        
+        CHECK(result.tempo == 500);
+        CHECK(result.phase == 0);
+        CHECK(result.confidence >= previous_confidence);
+        
+        previous_confidence = result.confidence;
+    }
+    
+    CHECK(result.confidence == 255);
+}
+
+static void TestPhase()
+{
+    TapTempo tap_tempo;
+    TapTempoResult result;
+    
+    TapTempoInitialize(&tap_tempo, MIN_INTERVAL, MAX_INTERVAL);
+    
+    TapTempoPush(&tap_tempo, 0);
+    TapTempoPush(&tap_tempo, 400);
+    TapTempoPush(&tap_tempo, 800);
+    
+    //
+    // 40ms late on a 400ms beat is a tenth of a beat past it, 40ms early a
+    // tenth short of the next one. The phase is against the tempo before the
+    // tap.
+    //
+    
+    result = TapTempoPush(&tap_tempo, 1240);
+    CHECK(result.phase == ((40UL << 16) / 400));
+    CHECK(result.tempo == 413);
+    
+    result = TapTempoPush(&tap_tempo, 1240 + 372);
+    CHECK(result.phase == ((372UL << 16) / 413));
+    CHECK(result.phase > 0x8000);
+    
+    //
+    // Between taps, TapTempoGetPhase() tracks the position from the last tap.
+    //
+    
+    CHECK(result.tempo == 403);
+    CHECK(TapTempoGetPhase(&tap_tempo, 1612) == 0);
+    CHECK(TapTempoGetPhase(&tap_tempo, 1612 + 100) == ((100UL << 16) / 403));
+    CHECK(TapTempoGetPhase(&tap_tempo, 1612 + 403) == 0);
+}
+
+static void TestBounceAndRestart()
+{
+    TapTempo tap_tempo;
+    TapTempoResult result;
+    
+    TapTempoInitialize(&tap_tempo, MIN_INTERVAL, MAX_INTERVAL);
+    
+    TapTempoPush(&tap_tempo, 0);
+    TapTempoPush(&tap_tempo, 600);
+    result = TapTempoPush(&tap_tempo, 1200);
+    CHECK(result.tempo == 600);
+    CHECK(result.confidence > 0);
+    
+    //
+    // A tap inside the minimum interval is a bounce; nothing changes, and the
+    // next interval still counts from the real tap.
+    //
+    
+    result = TapTempoPush(&tap_tempo, 1210);
+    CHECK(result.tempo == 600);
+    CHECK(tap_tempo.previous_tap == 1200);
+    
+    result = TapTempoPush(&tap_tempo, 1800);
+    CHECK(result.tempo == 600);
+    CHECK(result.phase == 0);
+    
+    //
+    // A gap past the maximum interval restarts the measuring. The tempo is
+    // kept, the confidence isn't.
+    //
+    
+    result = TapTempoPush(&tap_tempo, 1800 + MAX_INTERVAL + 1);
+    CHECK(result.tempo == 600);
+    CHECK(result.confidence == 0);
+    CHECK(tap_tempo.previous_tap == (1800 + MAX_INTERVAL + 1));
+}
+
+static void TestTimestampWrap()
+{
+    TapTempo tap_tempo;
+    TapTempoResult result;
+    
+    TapTempoInitialize(&tap_tempo, MIN_INTERVAL, MAX_INTERVAL);
+    
+    //
+    // 300ms on from just short of the counter wrapping.
+    //
+    
+    TapTempoPush(&tap_tempo, 0xffffff00UL);
+    result = TapTempoPush(&tap_tempo, 44);
+    
+    CHECK(result.tempo == 300);
+}
+
+static void TestPushArray()
+{
+    static const uint32_t timestamps[] = { 100, 600, 1090, 1600, 1605, 2100, 2620, 3100 };
+    
+    TapTempo array_tap_tempo;
+    TapTempo tap_tempo;
+    TapTempoResult results[sizeof(timestamps) / sizeof(timestamps[0])];
+    uint32_t count = sizeof(timestamps) / sizeof(timestamps[0]);
+    uint32_t i;
+    
+    TapTempoInitialize(&array_tap_tempo, MIN_INTERVAL, MAX_INTERVAL);
+    TapTempoInitialize(&tap_tempo, MIN_INTERVAL, MAX_INTERVAL);
+    
+    CHECK(TapTempoPushArray(&array_tap_tempo, timestamps, results, count) == count);
+    
+    for (i = 0; i < count; i++)
+    {
+        TapTempoResult result = TapTempoPush(&tap_tempo, timestamps[i]);
+        
+        CHECK(results[i].tempo == result.tempo);
+        CHECK(results[i].phase == result.phase);
+        CHECK(results[i].confidence == result.confidence);
+    }
+}
+
+static void TestRejectedInterval()
+{
+    TapTempo tap_tempo;
+    
+    TapTempoInitialize(&tap_tempo, MIN_INTERVAL, MAX_INTERVAL);
+    
+    CHECK(TapTempoAddInterval(&tap_tempo, 500) == 500);
+    CHECK(TapTempoAddInterval(&tap_tempo, MIN_INTERVAL - 1) == 0);
+    CHECK(TapTempoAddInterval(&tap_tempo, MAX_INTERVAL + 1) == 0);
+    CHECK(tap_tempo.interval_count == 1);
+    CHECK(tap_tempo.tempo == 500);
+}
+
+static void TestStrayTap()
+{
+    TapTempo tap_tempo;
+    int i;
+    
+    TapTempoInitialize(&tap_tempo, MIN_INTERVAL, MAX_INTERVAL);
+    
+    for (i = 0; i < TAPTEMPO_AVERAGE_MAX_COUNT; i++)
+    {
+        TapTempoAddInterval(&tap_tempo, 500);
+    }
+    
+    //
+    // A single interval well off the tempo is held out of the average, and
+    // dropped when the next one is back on the tempo.
+    //
+    
+    CHECK(TapTempoAddInterval(&tap_tempo, 800) == 500);
+    CHECK(tap_tempo.is_changing == 1);
+    
+    CHECK(TapTempoAddInterval(&tap_tempo, 500) == 500);
+    CHECK(tap_tempo.is_changing == 0);
+    CHECK(tap_tempo.interval_sum == (500UL * TAPTEMPO_AVERAGE_MAX_COUNT));
+    
+    //
+    // Jitter inside TAPTEMPO_CHANGE_THRESHOLD goes straight into the average.
+    //
+    
+    CHECK(TapTempoAddInterval(&tap_tempo, 550) == 505);
+    CHECK(tap_tempo.is_changing == 0);
+}
+
+static void TestTempoChange()
+{
+    TapTempo tap_tempo;
+    int i;
+    
+    TapTempoInitialize(&tap_tempo, MIN_INTERVAL, MAX_INTERVAL);
+    
+    for (i = 0; i < TAPTEMPO_AVERAGE_MAX_COUNT; i++)
+    {
+        TapTempoAddInterval(&tap_tempo, 500);
+    }
+    
+    //
+    // Two intervals in a row off the tempo, and agreeing with each other, are
+    // a tempo change; the average restarts from the two of them.
+    //
+    
+    CHECK(TapTempoAddInterval(&tap_tempo, 800) == 500);
+    CHECK(TapTempoAddInterval(&tap_tempo, 810) == 805);
+    CHECK(tap_tempo.interval_count == 2);
+    CHECK(tap_tempo.is_changing == 0);
+    CHECK(tap_tempo.confidence == 0);
+    
+    //
+    // Two off the tempo but not agreeing with each other aren't; the second
+    // one waits for confirmation in its turn.
+    //
+    
+    CHECK(TapTempoAddInterval(&tap_tempo, 400) == 805);
+    CHECK(TapTempoAddInterval(&tap_tempo, 1200) == 805);
+    CHECK(tap_tempo.is_changing == 1);
+    CHECK(tap_tempo.change_interval == 1200);
+    CHECK(tap_tempo.interval_count == 2);
+}
+
+static void TestDutyCycle()
+{
+    uint32_t dividend = TEMPO_DUTY_CYCLE_DIVIDEND(8000000, 256);
+    uint32_t step_duty_cycle = TEMPO_BPM_STEP_DUTY_CYCLE(8000000, 256, 1);
+    
+    //
+    // 2^32 * 1000 / 31250 per millisecond, rounded to the nearest step.
+    //
+    
+    CHECK(dividend == 137438953);
+    CHECK(TempoCalcDutyCycle(dividend, 1000) == 137439);
+    
+    //
+    // 468ms and 469ms are both 128 BPM once quantized.
+    //
+    
+    CHECK(TempoCalcQuantizedDutyCycle(TEMPO_BPM_QUANTIZE_DIVIDEND(1), step_duty_cycle, 468) == 293203);
+    CHECK(TempoCalcQuantizedDutyCycle(TEMPO_BPM_QUANTIZE_DIVIDEND(1), step_duty_cycle, 469) == 293203);
+    
+    //
+    // A few milliseconds either way isn't a change.
+    //
+    
+    CHECK(TempoIsChange(1000, 1002) == 0);
+    CHECK(TempoIsChange(1000, 998) == 0);
+    CHECK(TempoIsChange(1000, 1003) == 1);
+    CHECK(TempoIsChange(1003, 1000) == 1);
+    
+    CHECK(TempoIsWithinLimits(50, MIN_INTERVAL, MAX_INTERVAL) == 1);
+    CHECK(TempoIsWithinLimits(49, MIN_INTERVAL, MAX_INTERVAL) == 0);
+    CHECK(TempoIsWithinLimits(10001, MIN_INTERVAL, MAX_INTERVAL) == 0);
+    CHECK(TempoIsWithinLimits(-1, MIN_INTERVAL, MAX_INTERVAL) == 0);
+}
+
+static void TestFineTrim()
+{
+    uint32_t duty_cycle = 100UL << TEMPO_TRIM_SHIFT;
+    int16_t trim = 0;
+    
+    //
+    // Positive trims slow down, negative ones speed up, a step at a time, and
+    // never past the limits.
+    //
+    
+    CHECK(TempoTrimDutyCycle(duty_cycle, 1, 0, 0xffffffffUL) == (duty_cycle - 100));
+    CHECK(TempoTrimDutyCycle(duty_cycle, -2, 0, 0xffffffffUL) == (duty_cycle + 200));
+    CHECK(TempoTrimDutyCycle(duty_cycle, 100, duty_cycle - 50, 0xffffffffUL) == (duty_cycle - 50));
+    CHECK(TempoTrimDutyCycle(duty_cycle, -100, 0, duty_cycle + 50) == (duty_cycle + 50));
+    
+    CHECK(TempoStepTrim(duty_cycle, &trim, -1, 0, 0xffffffffUL) == (duty_cycle + 100));
+    CHECK(trim == -1);
+    
+    //
+    // A step that would reach a limit, or take the trim out of range, is left
+    // out.
+    //
+    
+    CHECK(TempoStepTrim(duty_cycle, &trim, -1, 0, duty_cycle + 200) == 0);
+    CHECK(trim == -1);
+    
+    trim = TEMPO_TRIM_MAX;
+    CHECK(TempoStepTrim(duty_cycle, &trim, 1, 0, 0xffffffffUL) == 0);
+    CHECK(trim == TEMPO_TRIM_MAX);
+}
+
+static void TestAlignment()
+{
+    TempoAlignment alignment = TEMPO_ALIGNMENT_INIT(1);
+    
+    //
+    // 4/3 lines up every 3 beats, 2/4 every 2, and both every 6.
+    //
+    
+    TempoSetRatio(&alignment, 0, 4, 3);
+    TempoSetRatio(&alignment, 1, 2, 4);
+    
+    CHECK(alignment.output[0].alignment_period == 3);
+    CHECK(alignment.output[1].alignment_period == 2);
+    CHECK(alignment.period == 6);
+    
+    CHECK(TempoStepAlignment(&alignment) == 0x03);
+    CHECK(TempoStepAlignment(&alignment) == 0x00);
+    CHECK(TempoStepAlignment(&alignment) == 0x02);
+    CHECK(TempoStepAlignment(&alignment) == 0x01);
+    CHECK(TempoStepAlignment(&alignment) == 0x02);
+    CHECK(TempoStepAlignment(&alignment) == 0x00);
+    CHECK(TempoStepAlignment(&alignment) == 0x03);
+    
+    //
+    // Two beats in, 4/3 has done 1 1/3 cycles, and is back on a whole cycle
+    // half way through the next beat.
+    //
+    
+    TempoResetAlignment(&alignment);
+    TempoStepAlignment(&alignment);
+    TempoStepAlignment(&alignment);
+    
+    CHECK(TempoCalcPhase(&alignment, 0, 0) == 0x55555500UL);
+    CHECK(TempoCalcPhase(&alignment, 0, 0x80000000UL) == 0);
+    
+    //
+    // Skipping beats wraps around the common period.
+    //
+    
+    TempoSkipAlignmentBeats(&alignment, 5);
+    
+    CHECK(alignment.index == 1);
+    CHECK(alignment.output[0].alignment_beat == 1);
+    CHECK(alignment.output[1].alignment_beat == 1);
+    
+    //
+    // A longer base period keeps the count going over it whatever the ratio.
+    //
+    
+    {
+        TempoAlignment span = TEMPO_ALIGNMENT_INIT(12);
+        
+        TempoSkipAlignmentBeats(&span, 7);
+        TempoSetRatio(&span, 0, 1, 4);
+        
+        CHECK(span.period == 12);
+        CHECK(span.index == 7);
+        CHECK(span.output[0].alignment_beat == 3);
+    }
+}
@@ -0,0 +1,75 @@
+//
+// Tap-tempo clock for 8-bit AVR.
+// 
+// Copyright (C) 2013-2016 Harald Sabro
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Contact info
+// ------------
+// Website: sabrotone.com
+// Email: harald (AT) website 
+//
+
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include "main.h"
+#include "lfo.h"
+
+#if LFO_OUTPUTS
+
+//
+// 511.5 * (1 - cos(2 * pi * (index + 0.5) / 256)), rounded; see lfo.h.
+//
+
+const uint16_t k_lfo_sine_table[64] PROGMEM =
+{
+       0,    0,    1,    2,    3,    5,    6,    9,   11,   14,   17,   20,   24,   28,   32,   37,
+      41,   46,   52,   57,   63,   70,   76,   83,   90,   97,  104,  112,  120,  128,  137,  145,
+     154,  163,  173,  182,  192,  202,  212,  222,  233,  243,  254,  265,  276,  287,  298,  310,
+     322,  333,  345,  357,  369,  381,  393,  406,  418,  430,  443,  455,  468,  480,  493,  505
+};
+
+/*====== Public functions ===================================================== 
+=============================================================================*/
+
+void InitializeLfo()
+{
+    //
+    // Set up Timer1 in 10-bit fast PWM mode with no prescaler, counting to
+    // 0x3ff, and start every output at its lowest point.
+    //
+    
+    TC1H = LFO_OUTPUT_MAX >> 8;
+    OCR1C = LFO_OUTPUT_MAX & 0xff;          // TOP.
+    
+    TC1H = 0x00;
+    OCR1A = 0x00;
+    OCR1B = 0x00;
+    
+    DDRB |= (1 << LFO_OUT);
+    
+#if LFO_OUTPUTS > 1
+    TCCR1A = (1 << PWM1A) | (1 << COM1A1) | (1 << PWM1B) | (1 << COM1B1); // OC1A and OC1B. Clear on compare match.
+#else
+    TCCR1A = (1 << PWM1B) | (1 << COM1B1);  // OC1B only. Clear on compare match.
+#endif
+    TCCR1B = (1 << CS10);                   // No prescaler.
+    TCCR1D = 0x00;                          // WGM11:10 = 00 enables Fast PWM.
+    TIMSK |= (1 << TOIE1);                  // Timer1 overflow interrupt.
+}
+
+#endif // LFO_OUTPUTS
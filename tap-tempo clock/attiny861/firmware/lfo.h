@@ -0,0 +1,137 @@
+//
+// Tap-tempo clock for 8-bit AVR.
+// 
+// Copyright (C) 2013-2016 Harald Sabro
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Contact info
+// ------------
+// Website: sabrotone.com
+// Email: harald (AT) website 
+//
+
+
+#ifndef __LFO_H__
+#define __LFO_H__
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include "main.h"
+
+//
+// LFO outputs (LFO_OUTPUTS=1 or 2 in the Makefile). Sine waves at the tempo,
+// played from the same base phase accumulator as the clock outputs, so they
+// stay locked to the sync input and the crystal.
+//
+// Timer1 runs 10-bit fast PWM off the system clock (see TIMER1_PERIOD), and
+// its overflow interrupt updates every output at once:
+//
+// - Output 1 on OC1B (PB3, LFO_OUT) follows the base tempo, at its lowest
+//   point on the clock edge.
+// - Output 2 on OC1A (PB1) runs 2^LFO_RATE_SHIFT times the base tempo, offset
+//   by LFO_PHASE_OFFSET (0 - 255 of a cycle). It takes over the SYNC_2X_OUT
+//   pin.
+//
+// Note: OC1D (PB5) would make a third output, but PB4 and PB5 hold the
+//       crystal. Timer1 also stays off the 64MHz PLL; the PLL runs off the
+//       internal RC oscillator, which would take the sample rate off the
+//       crystal.
+//
+// Note 2: The sample period is 1024 cycles. The handler gets one table
+//         lookup per output on top of the base accumulator, and the rate
+//         multiplier is a shift (the attiny861 has no hardware multiply).
+//         That's plenty of time left for the sync and encoder interrupts.
+//
+
+#ifndef LFO_RATE_SHIFT
+#define LFO_RATE_SHIFT                  0
+#endif
+
+#ifndef LFO_PHASE_OFFSET
+#define LFO_PHASE_OFFSET                0
+#endif
+
+//
+// Largest output value; 10 bits.
+//
+
+#define LFO_OUTPUT_MAX                  0x3ff
+
+//
+// A quarter of a sine wave, starting at the lowest point. Sampled half a step
+// in, so that the other three quarters mirror it exactly.
+//
+
+extern const uint16_t k_lfo_sine_table[64] PROGMEM;
+
+//
+// Public function prototypes.
+//
+
+void InitializeLfo();
+
+//
+// Public inline functions. Called from the Timer1 interrupt handler.
+//
+
+ISR_INLINE uint16_t LfoSineValue(uint8_t index)
+{
+    uint8_t quarter_index = index & 0x3f;
+    uint16_t value;
+    
+    //
+    // The second and fourth quarters run the table backwards, and the second
+    // and third are upside down.
+    //
+    
+    if (index & 0x40)
+    {
+        quarter_index = 0x3f - quarter_index;
+    }
+    
+    value = pgm_read_word(&k_lfo_sine_table[quarter_index]);
+    
+    if (((index >> 1) ^ index) & 0x40)
+    {
+        value = LFO_OUTPUT_MAX - value;
+    }
+    
+    return value;
+}
+
+ISR_INLINE void UpdateLfoOutputs(uint32_t phase_accumulator, uint8_t table_index)
+{
+    uint16_t value = LfoSineValue(table_index);
+    
+    //
+    // The top two bits go through the shared TC1H register, which has to be
+    // written before each compare register.
+    //
+    
+    TC1H = value >> 8;
+    OCR1B = value & 0xff;
+    
+#if LFO_OUTPUTS > 1
+    value = LfoSineValue((uint8_t)((phase_accumulator << LFO_RATE_SHIFT) >> 24) + LFO_PHASE_OFFSET);
+    
+    TC1H = value >> 8;
+    OCR1A = value & 0xff;
+#else
+    (void)phase_accumulator;
+#endif
+}
+
+#endif // __LFO_H__
@@ -42,19 +42,20 @@
 
 #include "switching.h"
 #include "signaling.h"
+#include "lfo.h"
 #include "main.h"
 
 //
 // Defines and structs.
 //
 
-#define TIMER0_PRESCALER                64.0f
+#define TIMER0_PRESCALER                64UL
 
 //
 // Timer0 trigger rate in Hertz.
 //
 
-#define TIMER0_FREQUENCY                0.001f
+#define TIMER0_FREQUENCY                1000UL
 
 //
 // Timer0 trigger rate in milliseconds.
@@ -83,8 +84,6 @@ extern volatile uint32_t g_base_phase_accumulator;
 
 extern volatile uint16_t g_speed_adjust_ms_count;
 
-extern volatile uint8_t g_average_tempo_count;
-
 /*====== Public functions ===================================================== 
 =============================================================================*/
 
@@ -119,6 +118,7 @@ int main()
     // Initialize signaling, including setting the default base tempo.
     //
     
+    InitializeSignaling();
     SetBaseTempo(DEFAULT_TEMPO);
     
     //
@@ -134,12 +134,12 @@ int main()
     
     //
     // The trigger value should come out as
-    // ((8,000,000 / 64.0) * 0.001) - 1 = 124
+    // (8,000,000 / 64 / 1000) - 1 = 124
     // which is within 8-bit range (though we could have used a 16-bit compare
     // value for this particular timer).
     // 
     
-    OCR0A = ((CLOCK_FREQUENCY / TIMER0_PRESCALER) * TIMER0_FREQUENCY) - 1;
+    OCR0A = (CLOCK_FREQUENCY / TIMER0_PRESCALER / TIMER0_FREQUENCY) - 1;
     TCCR0A = (1 << CTC0);                   // Clear Timer on Compare.
     TCCR0B = (1 << CS01) | (1 << CS00);     // Prescalar of 64.
     TCNT0L = 0x00;                          // Starting at 0.
@@ -151,18 +151,26 @@ int main()
     // This timer is used to generate the LFO PWM output signal.
     //
     
+#if LFO_OUTPUTS
+    InitializeLfo();
+#else
     TCCR1A = (1 << PWM1B) | (1 << COM1B1);  // Enable PWM-mode on OCR1B. Clear on compare match.
     TCCR1B = (1 << CS10);                   // No prescaler.
     TCCR1D = 0x00;                          // WGM11:10 = 00 enables Fast PWM.
     TIMSK |= (1 << TOIE1);                  // Timer1 overflow interrupt.
+#endif
     
     //
-    // Set up PA1, PA4, PA5, PA6, PA7 and PB6 (PCINT1, PCINT4, PCINT5, PCINT6,
-    // PCINT7 and PCINT14 respectively) for pin change interrupts.
+    // Set up PA1, PA6 and PA7 (PCINT1, PCINT6 and PCINT7 respectively) for pin
+    // change interrupts; the sync input and the rotary encoder.
+    //
+    // The configuration pins (PA4, PA5 and PB6) are slow toggle switches and
+    // are polled through the debounced switch states in the main loop
+    // instead, so contact chatter can't fire bursts of interrupts.
     //
     
-    PCMSK0 = (1 << PCINT1) | (1 << PCINT4) | (1 << PCINT5) | (1 << PCINT6) | (1 << PCINT7); // PCINT7:0 mask.
-    PCMSK1 = (1 << PCINT14);                // PCINT11:8 mask.
+    PCMSK0 = (1 << PCINT1) | (1 << PCINT6) | (1 << PCINT7); // PCINT7:0 mask.
+    PCMSK1 = 0x00;                          // PCINT15:8 mask.
     GIMSK = (1 << PCIE0) | (1 << PCIE1);    // Enable pin change interrupts on
                                             // both PCINT7:0 and PCINT11:8.
     
@@ -324,6 +332,72 @@ int main()
                 g_speed_adjust_reset_ms_count = 0;
             }
         }
+        
+        //
+        // Check for a change on the input selection pin.
+        //
+        // Note: The configuration pins share the state flags byte with flags
+        //       the ISRs modify, so any updates are done atomically.
+        //
+        
+        if (SwitchWasClosed(1 << INPUT_SELECT_IN) || SwitchWasOpened(1 << INPUT_SELECT_IN))
+        {
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+            {
+                g_state.is_clock_input_source = SwitchWasClosed(1 << INPUT_SELECT_IN) ? 1 : 0;
+                
+                //
+                // We have a change in the input source selection. If we were
+                // in the middle of counting tempo we need to stop doing that.
+                // This is specially important if we're transitioning away from
+                // using the clock input as source since there's a 50% chance
+                // we'll get stuck inside a tempo counting state.
+                //
+                
+                TempoCountTimeout();
+                
+                //
+                // We also wipe any previously stored tempos in case of
+                // averaging.
+                //
+                
+                ClearTempoAverage();
+            }
+        }
+        
+        //
+        // Check for a change on the double speed clock input enable pin.
+        //
+        
+        if (SwitchWasClosed(1 << SYNC_IS_2X_IN) || SwitchWasOpened(1 << SYNC_IS_2X_IN))
+        {
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+            {
+                g_state.is_2x_clock_input = SwitchWasClosed(1 << SYNC_IS_2X_IN) ? 1 : 0;
+            }
+        }
+        
+        //
+        // Check for a change on the tap tempo averaging enable pin.
+        //
+        
+        if (SwitchWasClosed(SWITCH_PB(TAP_AVERAGING_IN)) || SwitchWasOpened(SWITCH_PB(TAP_AVERAGING_IN)))
+        {
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+            {
+                g_state.is_averaging_tempo = SwitchWasClosed(SWITCH_PB(TAP_AVERAGING_IN)) ? 1 : 0;
+                
+                //
+                // Invalidate any accumulated tap tempo readings when averaging
+                // is disabled.
+                //
+                
+                if (g_state.is_averaging_tempo == 0)
+                {
+                    ClearTempoAverage();
+                }
+            }
+        }
     }
 }
 
@@ -339,7 +413,7 @@ ISR(TIMER0_COMPA_vect)
     //
     // Run each switch input through a debounce routine to make sure we get rid
     // of any noise due to the switch contacts bouncing. This routine
-    // DebounceSwitches all 8 input pins on PA simultaneously.
+    // DebounceSwitches all 16 input pins on PA and PB simultaneously.
     //
     
     DebounceSwitches();
@@ -398,7 +472,7 @@ ISR(TIMER0_COMPA_vect)
 //
 // Timer1 overflow interrupt handler. This is where the LFO signal is
 // generated.
-// Frequency: 31.25kHz
+// Frequency: 31.25kHz (7.8125kHz with LFO outputs)
 //
 
 ISR(TIMER1_OVF_vect)
@@ -426,6 +500,10 @@ ISR(TIMER1_OVF_vect)
     g_base_phase_accumulator += g_base_duty_cycle;
     g_base_table_index = (g_base_phase_accumulator & 0xff000000) >> 24;
     
+#if LFO_OUTPUTS
+    UpdateLfoOutputs(g_base_phase_accumulator, g_base_table_index);
+#endif
+    
     //
     // Flag whenever there's an overflow in the base table index, i.e. the base
     // tempo, has just completed a full cycle.
@@ -453,17 +531,23 @@ ISR(TIMER1_OVF_vect)
         //       continue even when we're currently counting tempo (see
         //       StartTempoCount() for more).
         //
+        // Note 2: With two LFO outputs the second one has the pin instead.
+        //
         
+#if LFO_OUTPUTS < 2
         PORTB ^= (1 << SYNC_2X_OUT);
+#endif
     }
+#if LFO_OUTPUTS < 2
     else if ((previous_base_table_index < 0x80) && (g_base_table_index >= 0x80))
     {
         PORTB ^= (1 << SYNC_2X_OUT);
     }
+#endif
 }
 
 //
-// Pin change interrupt handler. Handles the rotary encoder.
+// Pin change interrupt handler. Handles the sync input and the rotary encoder.
 //
 
 ISR(PCINT_vect)
@@ -472,96 +556,29 @@ ISR(PCINT_vect)
     static uint8_t encoder_samples = 3;
     static int8_t encoder_value = 0;
     static uint8_t previous_interrupt_a = 0x00;
-    static uint8_t previous_interrupt_b = 0x00;
     
     uint8_t interrupt_a = PINA;
-    uint8_t interrupt_b = PINB;
     
     //
-    // Check for rotary encoder pin change interrupts.
+    // Work out which pins changed since last time once, up front, and only
+    // run the handling for those. Then remember the current pin states for
+    // the next time around.
     //
-    
-    if (((interrupt_a & (1 << ROTARY_A_IN)) != (previous_interrupt_a & (1 << ROTARY_A_IN))) ||
-        ((interrupt_a & (1 << ROTARY_B_IN)) != (previous_interrupt_a & (1 << ROTARY_B_IN))))
-    {
-        //
-        // One or more rotary encoder pins have changed since last time. 
-        //
-        
-        //
-        // Keep sampling the four latest rotary states, as pairs of bits, in a
-        // shift register. Make room for the next sample (and discard the
-        // oldest one).
-        //
-        
-        encoder_samples <<= 2;
-        
-        //
-        // Since the current rotary samples need to be added to the shift
-        // register at the start, and they do not necessarily align pin-wise,
-        // they must be adjusted accordingly.
-        //
-        
-        encoder_samples |= ((interrupt_a & (1 << ROTARY_A_IN)) >> ROTARY_A_IN) | ((interrupt_a & (1 << ROTARY_B_IN)) >> (ROTARY_B_IN - 1));
-        
-        //
-        // Update the encoder value and check the result.
-        //
-        
-        encoder_value += encoder_table[(encoder_samples & 0x0f)];
-        if (encoder_value > 3)
-        {
-            ModifySpeedAdjust(1);
-            
-            encoder_value = 0;
-        }
-        else if (encoder_value < -3)
-        {
-            ModifySpeedAdjust(-1);
-            
-            encoder_value = 0;
-        }
-    }
-    
+    // Only the sync input and the rotary encoder are unmasked; the
+    // configuration pins are polled from the main loop.
     //
-    // Check for a change on the input selection pin.
-    //
-
-    if ((interrupt_a & (1 << INPUT_SELECT_IN)) != (previous_interrupt_a & (1 << INPUT_SELECT_IN)))
-    {
-        g_state.is_clock_input_source = ((interrupt_a & (1 << INPUT_SELECT_IN)) == 0) ? 1 : 0;
-
-        //
-        // We have a change in the input source selection. If we were in the
-        // middle of counting tempo we need to stop doing that. This is
-        // specially important if we're transitioning away from using the clock
-        // input as source since there's a 50% chance we'll get stuck inside a
-        // tempo counting state.
-        //
-
-        TempoCountTimeout();
-
-        //
-        // We also wipe any previously stored tempos in case of averaging.
-        //
-
-        g_average_tempo_count = 0;
-    }
     
-    //
-    // Check for a change on the double speed clock input enable pin.
-    //
-
-    if ((interrupt_a & (1 << SYNC_IS_2X_IN)) != (previous_interrupt_a & (1 << SYNC_IS_2X_IN)))
-    {
-        g_state.is_2x_clock_input = ((interrupt_a & (1 << SYNC_IS_2X_IN)) == 0) ? 1 : 0;
-    }
+    uint8_t changed_a = interrupt_a ^ previous_interrupt_a;
+    
+    previous_interrupt_a = interrupt_a;
     
     //
-    // Check for a change on the clock/sync input pin.
+    // Check for a change on the clock/sync input pin. Handled ahead of the
+    // others, as it's the one where timing matters; the tempo count starts or
+    // stops as close to the edge as possible.
     //
     
-    if ((interrupt_a & (1 << SYNC_IN)) != (previous_interrupt_a & (1 << SYNC_IN)))
+    if (changed_a & (1 << SYNC_IN))
     {
         //
         // Honor the input selection by only proceeding if clock input is
@@ -643,28 +660,47 @@ ISR(PCINT_vect)
     }
     
     //
-    // Check for a change on the tap tempo averaging enable pin.
+    // Check for rotary encoder pin change interrupts.
     //
-
-    if ((interrupt_b & (1 << TAP_AVERAGING_IN)) != (previous_interrupt_b & (1 << TAP_AVERAGING_IN)))
+    
+    if (changed_a & ((1 << ROTARY_A_IN) | (1 << ROTARY_B_IN)))
     {
-        g_state.is_averaging_tempo = ((interrupt_b & (1 << TAP_AVERAGING_IN)) == 0) ? 1 : 0;
-
         //
-        // Invalidate any accumulated tap tempo readings when averaging is
-        // disabled.
+        // One or more rotary encoder pins have changed since last time. 
+        //
+        
+        //
+        // Keep sampling the four latest rotary states, as pairs of bits, in a
+        // shift register. Make room for the next sample (and discard the
+        // oldest one).
+        //
+        
+        encoder_samples <<= 2;
+        
+        //
+        // Since the current rotary samples need to be added to the shift
+        // register at the start, and they do not necessarily align pin-wise,
+        // they must be adjusted accordingly.
+        //
+        
+        encoder_samples |= ((interrupt_a & (1 << ROTARY_A_IN)) >> ROTARY_A_IN) | ((interrupt_a & (1 << ROTARY_B_IN)) >> (ROTARY_B_IN - 1));
+        
+        //
+        // Update the encoder value and check the result.
         //
         
-        if (g_state.is_averaging_tempo == 0)
+        encoder_value += encoder_table[(encoder_samples & 0x0f)];
+        if (encoder_value > 3)
+        {
+            ModifySpeedAdjust(1);
+            
+            encoder_value = 0;
+        }
+        else if (encoder_value < -3)
         {
-            g_average_tempo_count = 0;
+            ModifySpeedAdjust(-1);
+            
+            encoder_value = 0;
         }
     }
-    
-    //
-    // Remember the current pin states for the next time around.
-    // 
-    
-    previous_interrupt_a = interrupt_a;
-    previous_interrupt_b = interrupt_b;
 }
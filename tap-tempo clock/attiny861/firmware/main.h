@@ -32,6 +32,34 @@
 
 #define CLOCK_FREQUENCY     			8000000UL
 
+//
+// LFO_OUTPUTS (Makefile) turns the clock into an LFO as well, with 1 or 2
+// waveform outputs on Timer1 (see lfo.h). 0 is the plain clock.
+//
+
+#ifndef LFO_OUTPUTS
+#define LFO_OUTPUTS                     0
+#endif
+
+//
+// Timer1 clock cycles per PWM period, which is also one DDS sample. 8-bit PWM
+// (31.25kHz) for the clock, 10-bit PWM (7.8125kHz) for the LFO outputs.
+//
+
+#if LFO_OUTPUTS
+#define TIMER1_PERIOD                   1024UL
+#else
+#define TIMER1_PERIOD                   256UL
+#endif
+
+//
+// Functions making up the interrupt handlers are forced inline. Any call from
+// an ISR makes avr-gcc save and restore every call-clobbered register on top
+// of the call itself.
+//
+
+#define ISR_INLINE                      static inline __attribute__((always_inline))
+
 //
 // Pin configuration defines.
 //
@@ -47,7 +75,7 @@
 #define SYNC_OUT                		PB0     /* Tempo indicator / sync output */
 #define SYNC_2X_OUT                     PB1     /* Sync 2x output */
 #define TAP_ACTIVE_OUT                  PB2     /* LED indicator when actively counting tempo */
-#define UNUSED1                         PB3
+#define LFO_OUT                         PB3     /* LFO output (OC1B), LFO builds only */
 #define CRYSTAL_IN1                     PB4     /* Crystal leg #1 */
 #define CRYSTAL_IN2                     PB5     /* Crystal leg #2 */
 #define TAP_AVERAGING_IN                PB6     /* Accumulate tap inputs, and average */
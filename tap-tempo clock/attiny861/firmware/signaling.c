@@ -23,37 +23,58 @@
 //
 
 #include <avr/io.h>
-#include <stdlib.h>
 
 #include "main.h"
 #include "signaling.h"
+#include "taptempo.h"
+#include "tempo.h"
 
 //
-// Book keeping defines.
+// Timer1 sample rate based on the PWM period (see TIMER1_PERIOD):
+// 8MHz /  256 = 31.25kHz
+// 8MHz / 1024 =  7.8125kHz
+//
+// The second isn't a whole number, so the period is used rather than the rate
+// in the constants below.
 //
 
-#define TEMPO_TO_FREQUENCY              1000.0f
+//
+// The constant part of the duty cycle (phase step per sample) for a tempo,
+// worked out here at compile time, leaving a single integer division at run
+// time (see lib/taptempo/tempo.h).
+//
 
-#define WAVEFORM_RESOLUTION             256
+#define DUTY_CYCLE_DIVIDEND             TEMPO_DUTY_CYCLE_DIVIDEND(CLOCK_FREQUENCY, TIMER1_PERIOD)
 
-#define TEMPO_AVERAGE_MAX_COUNT         10
+//
+// Duty cycles at the LFO limits, for bounds checking fine speed adjustment.
+//
+
+#define DUTY_CYCLE_MIN                  (DUTY_CYCLE_DIVIDEND / LFO_MIN_TEMPO)
+#define DUTY_CYCLE_MAX                  (DUTY_CYCLE_DIVIDEND / LFO_MAX_TEMPO)
 
 //
-// Timer0 sample rate based on wave table resolution:
-// 8Mhz / 256 =  31.25kHz
-// 8MHz / 128 =  62.50kHz
-// 8MHz /  64 = 125.00kHz
+// BPM_QUANTIZE (Makefile) snaps the tempo to the nearest whole BPM (1) or half
+// BPM (2); 0 leaves it at the millisecond count. The duty cycle is then worked
+// out from the BPM instead of the milliseconds, so a tempo like 128 BPM
+// (468.75ms) comes out exact, and the same on every unit.
 //
 
-#define TIMER1_SAMPLE_RATE              (CLOCK_FREQUENCY / WAVEFORM_RESOLUTION)
-#define DUTY_CYCLE_DIVISOR              (0x100000000 / TIMER1_SAMPLE_RATE)
+#ifndef BPM_QUANTIZE
+#define BPM_QUANTIZE                    0
+#endif
+
+#if BPM_QUANTIZE
+#define BPM_QUANTIZE_DIVIDEND           TEMPO_BPM_QUANTIZE_DIVIDEND(BPM_QUANTIZE)
+#define BPM_STEP_DUTY_CYCLE             TEMPO_BPM_STEP_DUTY_CYCLE(CLOCK_FREQUENCY, TIMER1_PERIOD, BPM_QUANTIZE)
+#endif
 
 //
 // Local function prototypes.
 //
 
 void RecalculateTempo();
-uint16_t CalculateAverageTempo(uint16_t tempo);
+uint32_t CalcBaseDutyCycle(uint16_t tempo);
 
 //
 // Global variables.
@@ -67,8 +88,21 @@ volatile uint32_t g_base_phase_accumulator;
 
 volatile int16_t g_tempo_adjust_offset;
 
-volatile uint16_t g_average_tempo[TEMPO_AVERAGE_MAX_COUNT];
-volatile uint8_t g_average_tempo_count = 0;
+//
+// Fine speed trim in 1/2^TEMPO_TRIM_SHIFT steps of the duty cycle,
+// positive slowing down like g_tempo_adjust_offset. Applied on top of whatever
+// the millisecond tempo is, and only cleared by ResetSpeedAdjustSetting().
+//
+
+volatile int16_t g_tempo_fine_trim;
+
+//
+// Tap interval averaging, shared with the host side tools (lib/taptempo).
+// Only touched from SetBaseTempo() and ClearTempoAverage(), which both run
+// with interrupts disabled.
+//
+
+TapTempo g_tap_tempo;
 
 extern volatile state_flags g_state;
 extern volatile uint16_t g_tempo_ms_count;
@@ -76,6 +110,11 @@ extern volatile uint16_t g_tempo_ms_count;
 /*====== Public functions ===================================================== 
 =============================================================================*/
 
+void InitializeSignaling()
+{
+    TapTempoInitialize(&g_tap_tempo, LFO_MAX_TEMPO, LFO_MIN_TEMPO);
+}
+
 void SetBaseTempo(uint16_t milliseconds)
 {
     //
@@ -83,7 +122,7 @@ void SetBaseTempo(uint16_t milliseconds)
     // to accept frequencies in the range of 0.1Hz - 20Hz.
     //
     
-    if ((milliseconds > LFO_MIN_TEMPO) || (milliseconds < LFO_MAX_TEMPO))
+    if (!TempoIsWithinLimits(milliseconds, LFO_MAX_TEMPO, LFO_MIN_TEMPO))
     {
         return;
     }
@@ -95,18 +134,15 @@ void SetBaseTempo(uint16_t milliseconds)
 
     if ((g_state.is_clock_input_source == 0) && (g_state.is_averaging_tempo == 1))
     {
-        milliseconds = CalculateAverageTempo(milliseconds);
+        milliseconds = TapTempoAddInterval(&g_tap_tempo, milliseconds);
     }
     
     //
     // No need to recalculate if the new tempo count is just a few milliseconds
-    // off (would be typical when running off an external clock pulse).
-    //
-    // 2ms +/- seems to eliminate any syncing irregularities when clocked from
-    // an external tap-tempo chip.
+    // off (see TEMPO_CHANGE_TOLERANCE).
     //
     
-    if ((g_base_tempo > (milliseconds + 2)) || (g_base_tempo < (milliseconds - 2)))
+    if (TempoIsChange(g_base_tempo, milliseconds))
     {
         //
         // Store the new base tempo and recalculate how that affects the actual
@@ -190,15 +226,21 @@ void ResetBaseTempo()
     g_base_phase_accumulator = 0;
 }
 
+void ClearTempoAverage()
+{
+    TapTempoClearAverage(&g_tap_tempo);
+}
+
 void AdjustSpeed(int16_t change_value)
 {
     //
     // Make sure the result doesn't exceed either upper or lower LFO limits.
     //
+    // Worked out in 32 bits; the sum of an unsigned base tempo and two signed
+    // offsets doesn't reliably fit (or promote sensibly) in 16.
+    //
     
-    int16_t new_tempo_count = g_base_tempo + g_tempo_adjust_offset + change_value;
-    
-    if ((new_tempo_count > LFO_MIN_TEMPO) || (new_tempo_count < LFO_MAX_TEMPO))
+    if (!TempoIsWithinLimits((int32_t)g_base_tempo + g_tempo_adjust_offset + change_value, LFO_MAX_TEMPO, LFO_MIN_TEMPO))
     {
         return;
     }
@@ -207,9 +249,46 @@ void AdjustSpeed(int16_t change_value)
     RecalculateTempo();
 }
 
+void FineAdjustSpeed(int8_t change_value)
+{
+    uint16_t tempo = g_base_tempo + g_tempo_adjust_offset;
+    int16_t trim = g_tempo_fine_trim;
+    uint32_t duty_cycle;
+    
+    //
+    // Trim the speed by a fixed ratio of the duty cycle per step (see
+    // TEMPO_TRIM_SHIFT), positive slowing down like AdjustSpeed(). Whole
+    // millisecond steps are far too coarse at fast tempos (1% at 100ms) to
+    // trim against anything unsynced.
+    //
+    // From TEMPO_TRIM_SLOWEST milliseconds and slower a step would be more
+    // than a millisecond, so the speed is adjusted by a millisecond instead.
+    //
+    
+    if (tempo >= TEMPO_TRIM_SLOWEST)
+    {
+        AdjustSpeed(change_value);
+        return;
+    }
+    
+    //
+    // Same limits as AdjustSpeed(); a trim that would take the duty cycle to
+    // either LFO limit is left out.
+    //
+    
+    duty_cycle = TempoStepTrim(CalcBaseDutyCycle(tempo), &trim, change_value, DUTY_CYCLE_MIN, DUTY_CYCLE_MAX);
+    
+    if (duty_cycle != 0)
+    {
+        g_tempo_fine_trim = trim;
+        g_base_duty_cycle = duty_cycle;
+    }
+}
+
 void ResetSpeedAdjustSetting()
 {
     g_tempo_adjust_offset = 0;
+    g_tempo_fine_trim = 0;
     RecalculateTempo();
 }
 
@@ -218,63 +297,20 @@ void ResetSpeedAdjustSetting()
 
 void RecalculateTempo()
 {
-    float new_frequency;
-
-    //
-    // Convert the new tempo from a millisecond count to a frequency.
-    //
-    
-    new_frequency = (TEMPO_TO_FREQUENCY / (float)(g_base_tempo + g_tempo_adjust_offset));
+    uint16_t tempo = g_base_tempo + g_tempo_adjust_offset;
     
     //
-    // Recalculate the base duty cycle based on the new frequency.
+    // The fine trim stays on top of any new tempo or millisecond adjustment.
     //
     
-    g_base_duty_cycle = new_frequency * DUTY_CYCLE_DIVISOR;
+    g_base_duty_cycle = TempoTrimDutyCycle(CalcBaseDutyCycle(tempo), g_tempo_fine_trim, DUTY_CYCLE_MIN, DUTY_CYCLE_MAX);
 }
 
-uint16_t CalculateAverageTempo(uint16_t tempo)
+uint32_t CalcBaseDutyCycle(uint16_t tempo)
 {
-    static uint8_t index = 0;
-    uint8_t i;
-
-    //
-    // Store the current tempo reading in the correct array spot and update
-    // the reading count if we haven't yet reached the maximum.
-    //
-
-    if (g_average_tempo_count < TEMPO_AVERAGE_MAX_COUNT)
-    {
-        index = g_average_tempo_count;
-        g_average_tempo_count++;
-    }
-
-    g_average_tempo[index] = tempo;
-
-    //
-    // Update the array index making sure to wrap around the index if we reach
-    // the end. This way we always overwrite the oldest recorded tempo.
-    //
-
-    index++;
-    if (index >= TEMPO_AVERAGE_MAX_COUNT)
-    {
-        index = 0;
-    }
-
-    //
-    // Add up and divide by sample count to get a basic average tempo.
-    // Repurposing the input argument variable since we no longer need it. Note
-    // that average count will always be at least one at this point, so there's
-    // no risk dividing by zero.
-    //
-
-    tempo = 0;
-    for (i = 0; i < g_average_tempo_count; i++)
-    {
-        tempo += g_average_tempo[i];
-    }
-    tempo = tempo / g_average_tempo_count;
-
-    return tempo;
+#if BPM_QUANTIZE
+    return TempoCalcQuantizedDutyCycle(BPM_QUANTIZE_DIVIDEND, BPM_STEP_DUTY_CYCLE, tempo);
+#else
+    return TempoCalcDutyCycle(DUTY_CYCLE_DIVIDEND, tempo);
+#endif
 }
@@ -45,13 +45,16 @@
 // Public function prototypes.
 //
 
+void InitializeSignaling();
 void SetBaseTempo(uint16_t milliseconds);
 void StartTempoCount();
 void StopTempoCount();
 void TempoCountTimeout();
 void ResetBaseTempo();
+void ClearTempoAverage();
 
 void AdjustSpeed(int16_t change_value);
+void FineAdjustSpeed(int8_t change_value);
 void ResetSpeedAdjustSetting();
 
 #endif // __SIGNALING_H__
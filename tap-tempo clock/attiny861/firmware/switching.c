@@ -42,12 +42,12 @@
 // Global variables.
 //
 
-volatile uint8_t g_switch_samples[DEBOUNCE_CHECK_COUNT];
+volatile uint16_t g_switch_samples[DEBOUNCE_CHECK_COUNT];
 
-volatile uint8_t g_closed_switch_state;
-volatile uint8_t g_open_switch_state;
-volatile uint8_t g_closed_switch_state_changed;
-volatile uint8_t g_open_switch_state_changed;
+volatile uint16_t g_closed_switch_state;
+volatile uint16_t g_open_switch_state;
+volatile uint16_t g_closed_switch_state_changed;
+volatile uint16_t g_open_switch_state_changed;
 
 volatile uint8_t g_speed_adjust_multiplier;
 volatile uint16_t g_continuous_speed_adjustments;
@@ -66,11 +66,11 @@ void InitializeSwitching()
     
     for (count = 0; count < DEBOUNCE_CHECK_COUNT; count++)
     {
-        g_switch_samples[count] = 0xff;
+        g_switch_samples[count] = 0xffff;
     }
     
-    g_closed_switch_state = 0xff;
-    g_open_switch_state = 0xff;
+    g_closed_switch_state = 0xffff;
+    g_open_switch_state = 0xffff;
     
     //
     // Start out with no switch state changes, either open or close.
@@ -92,12 +92,12 @@ void DebounceSwitches()
 	static uint8_t switch_state_index = 0;
 	
 	//
-	// Get the current state of all PA pins and store them at whatever state
-    // index we're currently at, making sure to reset the state index whenever
-    // we go past the max count.
+	// Get the current state of all PA and PB pins and store them at whatever
+    // state index we're currently at, making sure to reset the state index
+    // whenever we go past the max count.
 	//
 	
-	g_switch_samples[switch_state_index] = PINA;
+	g_switch_samples[switch_state_index] = ((uint16_t)PINB << 8) | PINA;
 	
 	switch_state_index++;
 	if (switch_state_index >= DEBOUNCE_CHECK_COUNT)
@@ -109,10 +109,10 @@ void DebounceSwitches()
 void CalculateSwitchStates()
 {
     uint8_t count;
-	uint8_t accumulated_closed_switch_state = 0x00;
-    uint8_t accumulated_open_switch_state = 0xff;
-	uint8_t previous_closed_switch_state;
-    uint8_t previous_open_switch_state;
+	uint16_t accumulated_closed_switch_state = 0x0000;
+    uint16_t accumulated_open_switch_state = 0xffff;
+	uint16_t previous_closed_switch_state;
+    uint16_t previous_open_switch_state;
     
     //
 	// Build accumulated switch states based on DEBOUNCE_CHECK_COUNT number of
@@ -121,6 +121,10 @@ void CalculateSwitchStates()
     // debounce state bit will remain clear, and likewise, as soon as one or
     // more reading on a particular pin reads "open" that debounce state bit
     // will be cleared. And the opposite for open state.
+    //
+    // The samples are 16 bits and read while the Timer0 interrupt may be
+    // writing them, so a sample can come out half old and half new. That's
+    // harmless; every pin bit is debounced on its own.
 	//
 	
 	for (count = 0; count < DEBOUNCE_CHECK_COUNT; count++)
@@ -144,7 +148,7 @@ void CalculateSwitchStates()
     g_open_switch_state_changed = g_open_switch_state ^ previous_open_switch_state;
 }
 
-uint8_t SwitchWasClosed(uint8_t pins)
+uint16_t SwitchWasClosed(uint16_t pins)
 {
     //
     // Return the results from the last calculated closed switch state,
@@ -154,7 +158,7 @@ uint8_t SwitchWasClosed(uint8_t pins)
     return (~g_closed_switch_state & g_closed_switch_state_changed) & pins;
 }
 
-uint8_t SwitchWasOpened(uint8_t pins)
+uint16_t SwitchWasOpened(uint16_t pins)
 {
     //
     // Return the results from the last calculated open switch state, filtered
@@ -166,6 +170,8 @@ uint8_t SwitchWasOpened(uint8_t pins)
 
 void ModifySpeedAdjust(int8_t change_value)
 {
+    uint8_t is_fine_adjust = 0;
+    
     //
     // Dynamically increase and decrease the amount of adjustment applied based
     // on whether the user is quickly or slowly making adjustments.
@@ -189,19 +195,30 @@ void ModifySpeedAdjust(int8_t change_value)
         // speed adjustment step. 
         //
         
-        if ((g_continuous_speed_adjustments % 10) == 0)
+        if (((g_continuous_speed_adjustments % 10) == 0) &&
+            (g_speed_adjust_multiplier < SPEED_ADJUST_MULTIPLIER_MAX))
         {
             g_speed_adjust_multiplier += 10;
         }
     }
-    else if (g_speed_adjust_ms_count > 1000)
+    else
     {
         //
-        // No user input in a full second. Reset any continuous adjust state.
+        // A single detent on its own; trim the speed finely.
         //
         
-        g_speed_adjust_multiplier = 1;
-        g_continuous_speed_adjustments = 0;
+        is_fine_adjust = 1;
+        
+        if (g_speed_adjust_ms_count > 1000)
+        {
+            //
+            // No user input in a full second. Reset any continuous adjust
+            // state.
+            //
+            
+            g_speed_adjust_multiplier = 1;
+            g_continuous_speed_adjustments = 0;
+        }
     }
     
     //
@@ -214,6 +231,18 @@ void ModifySpeedAdjust(int8_t change_value)
     // Adjust the speed by the current speed adjust multiplier. Multiply by -1
     // to swap polarity and the direction in which speed increase and decrease.
     //
+    // Slow turns, a detent at a time, trim the speed finely (see
+    // FineAdjustSpeed()). Turning continuously adjusts it in milliseconds as
+    // before; a millisecond at a time to begin with, then more as the
+    // multiplier ramps up.
+    //
 
-    AdjustSpeed(g_speed_adjust_multiplier * change_value * -1);
+    if (is_fine_adjust)
+    {
+        FineAdjustSpeed(change_value * -1);
+    }
+    else
+    {
+        AdjustSpeed(g_speed_adjust_multiplier * change_value * -1);
+    }
 }
@@ -31,6 +31,20 @@
 
 #define SPEED_ADJUST_RESET_MIN_TIME         2000
 
+//
+// Largest step multiplier continuous speed adjustment will ramp up to. Kept
+// well clear of the 8-bit limit so the step size can't wrap back to small.
+//
+
+#define SPEED_ADJUST_MULTIPLIER_MAX         101
+
+//
+// Switch states cover both ports; PA pins in the low byte and PB pins in the
+// high byte. PA pins are passed as (1 << pin), PB pins through SWITCH_PB().
+//
+
+#define SWITCH_PB(pin)                      ((uint16_t)1 << ((pin) + 8))
+
 //
 // Public function prototypes.
 //
@@ -38,8 +52,8 @@
 void InitializeSwitching();
 void DebounceSwitches();
 void CalculateSwitchStates();
-uint8_t SwitchWasClosed(uint8_t pins);
-uint8_t SwitchWasOpened(uint8_t pins);
+uint16_t SwitchWasClosed(uint16_t pins);
+uint16_t SwitchWasOpened(uint16_t pins);
 
 void ModifySpeedAdjust(int8_t change_value);
 
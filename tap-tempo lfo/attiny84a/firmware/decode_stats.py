@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+
+#
+# Decode the field statistics ring from a raw EEPROM dump of the attiny84a
+# ("make stats" reads the EEPROM and runs this). See stats.c for the record
+# layout.
+#
+# Usage: decode_stats.py <eeprom.bin>
+#
+
+import struct
+import sys
+
+STATS_EEPROM_ADDRESS = 0x000
+STATS_RECORD_COUNT = 16
+
+RECORD_FORMAT = '<BBBBHHHHBHB'
+RECORD_SIZE = struct.calcsize(RECORD_FORMAT)
+
+RESET_CAUSES = [
+    (0x01, 'power-on'),
+    (0x02, 'external'),
+    (0x04, 'brown-out'),
+    (0x08, 'watchdog'),
+]
+
+
+def checksum(data):
+    return ~sum(data[:RECORD_SIZE - 1]) & 0xff
+
+
+def reset_cause_text(cause):
+    names = [name for bit, name in RESET_CAUSES if cause & bit]
+    return '+'.join(names) if names else 'unknown'
+
+
+def read_records(image):
+    records = []
+
+    for slot in range(STATS_RECORD_COUNT):
+        offset = STATS_EEPROM_ADDRESS + (slot * RECORD_SIZE)
+        data = image[offset:offset + RECORD_SIZE]
+
+        if len(data) < RECORD_SIZE or data[-1] != checksum(data):
+            continue
+
+        fields = struct.unpack(RECORD_FORMAT, data)
+        records.append({
+            'slot': slot,
+            'sequence': fields[0],
+            'session': fields[1],
+            'reset_cause': fields[2],
+            'max_sample_cycles': fields[3],
+            'uptime_minutes': fields[4],
+            'late_samples': fields[5],
+            'tap_timeouts': fields[6],
+            'sync_losses': fields[7],
+            'task_overruns': fields[8],
+            'sync_glitches': fields[9],
+        })
+
+    #
+    # Sequence numbers wrap around at 256; the newest record is the one all the
+    # others are (less than half the range) behind.
+    #
+
+    if records:
+        newest = records[0]['sequence']
+        for record in records:
+            if ((record['sequence'] - newest) & 0xff) < 0x80:
+                newest = record['sequence']
+        records.sort(key=lambda record: (newest - record['sequence']) & 0xff, reverse=True)
+
+    return records
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit('usage: %s <eeprom.bin>' % sys.argv[0])
+
+    with open(sys.argv[1], 'rb') as f:
+        image = f.read()
+
+    records = read_records(image)
+    if not records:
+        print('No field statistics records found.')
+        return
+
+    print('seq  session  reset       uptime  max cycles  late samples  tap timeouts  sync losses  sync glitches  overruns')
+    for record in records:
+        print('%3d  %7d  %-10s  %3d:%02d  %10d  %12d  %12d  %11d  %13d  %8d' % (
+            record['sequence'],
+            record['session'],
+            reset_cause_text(record['reset_cause']),
+            record['uptime_minutes'] // 60,
+            record['uptime_minutes'] % 60,
+            record['max_sample_cycles'],
+            record['late_samples'],
+            record['tap_timeouts'],
+            record['sync_losses'],
+            record['sync_glitches'],
+            record['task_overruns']))
+
+
+if __name__ == '__main__':
+    main()
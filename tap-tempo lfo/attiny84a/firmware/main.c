@@ -43,20 +43,16 @@
 
 #include "switching.h"
 #include "signaling.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "replay.h"
+#include "song.h"
 #include "main.h"
 
 //
 // Defines and structs.
 //
 
-#define TIMER1_PRESCALER                64.0f
-
-//
-// Timer1 trigger rate in Hertz.
-//
-
-#define TIMER1_FREQUENCY                0.001f
-
 //
 // Timer1 trigger rate in milliseconds.
 //
@@ -76,11 +72,8 @@
 volatile uint8_state_flags g_state;
 
 volatile uint16_t g_tempo_ms_count;
-volatile uint16_t g_mode_reset_ms_count;
 
-extern volatile uint8_t g_base_table_index;
-extern volatile uint32_t g_base_duty_cycle;
-extern volatile uint32_t g_base_phase_accumulator;
+volatile uint16_t g_mode_reset_ms_count;
 
 extern volatile uint16_t g_speed_adjustment_ms_count;
 
@@ -89,16 +82,30 @@ extern volatile uint16_t g_speed_adjustment_ms_count;
 
 int main()
 {
+    uint8_t reset_cause = MCUSR;
+    
     //
     // Entry point and main loop.
     //
     
+    //
+    // Keep what caused this reset for the field statistics, and clear it so
+    // the next one is recorded on its own.
+    //
+    
+    MCUSR = 0x00;
+    InitializeStats(reset_cause);
+    
     //
     // Specify which pins are to be output pins (and consequently which ones
     // are to be input pins).
     //
     
-    DDRA = (1 << WAVE_MODE_OUT) | (1 << MULTI_MODE_OUT) | (1 << LED_OUT) | (1 << TEMPO_OUT);
+#if SYNC_CAPTURE
+    DDRA = (1 << WAVE_MODE_OUT) | (1 << MULTI_MODE_OUT) | (1 << TEMPO_OUT);
+#else
+    DDRA = (1 << WAVE_MODE_OUT) | (1 << MULTI_MODE_OUT) | (1 << LFO_POLY_OUT) | (1 << TEMPO_OUT);
+#endif
     DDRB = (1 << SPEED_MODE_OUT) | (1 << LFO_OUT);
     
     //
@@ -108,6 +115,10 @@ int main()
     PORTA = 0xff;
     PORTB = 0xff;
     
+#if REPLAY
+    InitializeReplay();
+#endif
+    
     //
     // Initialize switching.
     //
@@ -125,8 +136,17 @@ int main()
     // Initialize signaling, including setting the default base tempo.
     //
     
+    InitializeSignaling();
     SetBaseTempo(DEFAULT_TEMPO);
     
+#if SONG_MODE
+    //
+    // Hand the tempo over to the song stored in EEPROM, if there is one.
+    //
+    
+    RestartSong();
+#endif
+    
     //
     // Disable USI and ADC to conserve power.
     //
@@ -136,10 +156,15 @@ int main()
     //
     // Set up Timer0 in fast PWM mode with no prescaler and a non-inverted
     // compare.
-    // This timer is used to generate the LFO PWM output signal.
+    // This timer is used to generate the LFO PWM output signal on OC0A, and
+    // the polyrhythm LFO PWM output signal on OC0B.
     //
     
-    TCCR0A = (1 << COM0A1) | (1<<COM0B1);                 // Clear OC0A on compare match. Set OC0A at BOTTOM.
+#if SYNC_CAPTURE
+    TCCR0A = (1 << COM0A1);                 // Clear OC0A on compare match. Set OC0A at BOTTOM. OC0B off (sync input).
+#else
+    TCCR0A = (1 << COM0A1) | (1 << COM0B1); // Clear OC0A/OC0B on compare match. Set OC0A/OC0B at BOTTOM.
+#endif
     TCCR0A |= (1 << WGM01) | (1 << WGM00);  // Fast-PWM (TOP == 0xff).
     TCCR0B = (1 << CS00);                   // No prescaler.
     TIMSK0 = (1 << TOIE0);                  // Timer0 overflow interrupt.
@@ -153,25 +178,40 @@ int main()
     
     //
     // The trigger value should come out as
-    // ((8,000,000 / 64.0) * 0.001) - 1 = 124
-    // which is within 8-bit range (though we could have used a 16-bit compare
-    // value for this particular timer).
+    // (8,000,000 / 64 / 1000) - 1 = 124 at 8MHz, or
+    // (20,000,000 / 8 / 1000) - 1 = 2499 at 20MHz,
+    // both within the 16-bit range of this timer.
     // 
     
-    OCR1A = ((CLOCK_FREQUENCY / TIMER1_PRESCALER) * TIMER1_FREQUENCY) - 1;
+    OCR1A = TIMER1_COMPARE;
     TCCR1A = 0x00;
     TCCR1B = (1 << WGM12);                  // CTC mode (TOP == OCR1A).
-    TCCR1B |= (1 << CS11) | (1 << CS10);    // Prescalar of 64.
+    TCCR1B |= TIMER1_CLOCK_SELECT;          // Prescalar of 64 (8MHz) or 8 (20MHz).
     TCNT1 = 0x0000;                         // Starting at 0.
     TIMSK1 = (1 << OCIE1A);                 // Enable timer 1A compare.
     
+#if SYNC_CAPTURE
+    //
+    // Capture the sync input on ICP1 as well, with the noise canceler on,
+    // starting with a falling edge.
+    //
+    
+    TCCR1B |= (1 << ICNC1);                 // Input capture noise canceler. Falling edge.
+    TIFR1 = (1 << ICF1);                    // Clear any capture so far.
+    TIMSK1 |= (1 << ICIE1);                 // Enable timer 1 input capture.
+#endif
+    
     //
     // Set up PA4, PA5 and PB1 (PCINT4, PCINT5 and PCINT9 respectively) for pin
-    // change interrupts.
+    // change interrupts. PB1 only without SYNC_CAPTURE.
     //
     
     PCMSK0 = (1 << PCINT4) | (1 << PCINT5); // PCINT7:0 mask.
+#if SYNC_CAPTURE
+    PCMSK1 = 0x00;                          // PCINT11:8 mask.
+#else
     PCMSK1 = (1 << PCINT9);                 // PCINT11:8 mask.
+#endif
     GIMSK = (1 << PCIE0) | (1 << PCIE1);    // Enable pin change interrupts on
                                             // both PCINT7:0 and PCINT11:8.
     
@@ -270,11 +310,18 @@ int main()
             // specified number of seconds, interpret the switch release as
             // reset of the current mode rather than a regular mode change.
             //
+            // Likewise, if the encoder was turned while the mode switch was
+            // held, the release just ends the alternate adjustment.
+            //
             
             if (g_state.is_resetting_mode == 1)
             {
                 g_state.is_resetting_mode = 0;
             }
+            else if (g_state.is_alternate_adjust == 1)
+            {
+                g_state.is_alternate_adjust = 0;
+            }
             else
             {
                 g_state.is_counting_mode_reset_time = 0;
@@ -286,50 +333,17 @@ int main()
                 }
             }
         }
+        
+        //
+        // Then run (a slice of) whatever deferred work is pending; at most one
+        // task per pass, so the switches keep getting polled at a steady
+        // rate regardless of how much recalculation is queued up.
+        //
+        
+        RunScheduledTask();
     }
 }
 
-//
-// Timer0 overflow interrupt handler. This is where the LFO signal is
-// generated.
-// Frequency: 31.25kHz
-//
-
-ISR(TIM0_OVF_vect)
-{
-    //
-    // Increase the phase accumulator by a given amount based on the required
-    // output signal frequency. Then use the high 8 bits (0-255) of the phase
-    // accumulator to identify what part of the wave to plot.
-    //
-    // We need both the base tempo (for the LED and sync output signal), and
-    // the actual LFO signal with applied tempo multiplier.
-    //
-    // Also see PlotWaveform().
-    //
-    
-    //
-    //
-    // TODO: Might be a shortcut just dividing by the given multiplier rather
-    //       than keeping a second set of variables.
-    //
-    //
-    
-    g_base_phase_accumulator += g_base_duty_cycle;
-    g_base_table_index = (g_base_phase_accumulator & 0xff000000) >> 24;
-    
-    //
-    // Flag whenever there's an overflow in the base table index, i.e. the base
-    // tempo, has just completed a full cycle.
-    //
-    
-    //
-    // Draw the next point on the waveform.
-    //
-    
-    PlotWaveform();
-}
-
 //
 // Timer1 compare interrupt handler. Triggers every k_timer1_frequency seconds.
 // Frequency: 1kHz
@@ -344,8 +358,18 @@ ISR(TIM1_COMPA_vect)
     // of any noise due to the switch contacts bouncing. This routine
     // DebounceSwitches all 8 input pins on PA simultaneously.
     //
+    // In a replay build, the recorded input is put on the pins first.
+    //
+    
+#if REPLAY
+    ReplayTick();
+#endif
     
     DebounceSwitches();
+    CountSchedulerTime();
+    CountStatsTime();
+    
+    CountSyncEdgeTime();
     
     //
     // Count tempo, if applicable.
@@ -384,7 +408,12 @@ ISR(TIM1_COMPA_vect)
             g_state.is_counting_mode_reset_time = 0;
             g_mode_reset_ms_count = 0;
             
-            ResetCurrentSelectionMode();
+            //
+            // The reset itself is left to the main loop, as it can be
+            // anything from a tempo recalculation to a depth change.
+            //
+            
+            ScheduleTask(TaskModeReset);
         }
     }
     
@@ -407,6 +436,7 @@ ISR(PCINT0_vect)
     static const int8_t encoder_table[16] = {0, -1, 1, 0, 1, 0, 0, -1, -1, 0, 0, 1, 0, 1, -1, 0};
     static uint8_t encoder_samples = 3;
     static int8_t encoder_value = 0;
+    int8_t change_value = 0;
     
     //
     // Keep sampling the four latest rotary states, as pairs of bits, in a
@@ -431,18 +461,111 @@ ISR(PCINT0_vect)
     encoder_value += encoder_table[(encoder_samples & 0x0f)];
     if (encoder_value > 3)
     {
-        ModifyCurrentSelectionMode(1);
-        
+        change_value = 1;
         encoder_value = 0;
     }
     else if (encoder_value < -3)
     {
-        ModifyCurrentSelectionMode(-1);
-        
+        change_value = -1;
         encoder_value = 0;
     }
+    
+    if (change_value != 0)
+    {
+        //
+        // Turning the encoder while the mode switch is held down (push-and-
+        // turn) makes an alternate adjustment instead, and stops the mode
+        // switch release from being taken as a mode change or reset.
+        //
+        
+        if ((g_state.is_counting_mode_reset_time == 1) || (g_state.is_alternate_adjust == 1))
+        {
+            g_state.is_alternate_adjust = 1;
+            g_state.is_counting_mode_reset_time = 0;
+            g_mode_reset_ms_count = 0;
+            
+            AlternateModifyCurrentSelectionMode(change_value);
+        }
+        else
+        {
+            ModifyCurrentSelectionMode(change_value);
+        }
+    }
 }
 
+#if SYNC_CAPTURE
+
+//
+// Timer1 input capture interrupt handler. Reads input clock/sync pulses on
+// ICP1. The edge time is latched by the hardware, so how long it takes to get
+// here doesn't matter.
+//
+
+ISR(TIM1_CAPT_vect)
+{
+    static uint8_t previous_is_start_edge = 0;
+    static uint16_t previous_ticks = 0;
+    static uint16_t period_start_ticks[2];
+    uint16_t ticks = ICR1;
+    uint8_t is_start_edge = ((TCCR1B & (1 << ICES1)) == 0) ? 1 : 0;
+    uint32_t capture_time = g_sync_capture_time;
+    SyncTime edge_time = g_sync_edge_time;
+    SyncTime period_time = g_sync_period_time[is_start_edge];
+    SyncTime elapsed;
+    SyncTime period;
+    
+    //
+    // Catch the next edge, which goes the other way. Changing the edge can
+    // flag a capture by itself, so that's cleared.
+    //
+    
+    TCCR1B ^= (1 << ICES1);
+    TIFR1 = (1 << ICF1);
+    
+    //
+    // Timer1 wraps every millisecond. If it wrapped just before the capture,
+    // the compare interrupt that counts the millisecond is still pending
+    // (this one goes first), and the counts are a millisecond behind. The
+    // edge is then taken as a millisecond's worth of counts further into the
+    // last millisecond counted. The edge time counts are reset here, and the
+    // pending compare interrupt puts them a millisecond ahead straight after;
+    // keeping the same ticks for the next edge makes up for that too.
+    //
+    
+    if ((TIFR1 & (1 << OCF1A)) && (ticks < (TIMER1_TICKS_PER_MS / 2)))
+    {
+        ticks += TIMER1_TICKS_PER_MS;
+    }
+    
+    //
+    // Run the edge through the glitch filter, timed from the capture of the
+    // previous edge on the pin, and of the last one let through going the same
+    // way. The edge direction always follows the pin; only the edges let
+    // through change previous_is_start_edge.
+    //
+    
+    elapsed = edge_time + ticks - previous_ticks;
+    period = period_time + ticks - period_start_ticks[is_start_edge];
+    previous_ticks = ticks;
+    
+    if (IsSyncEdgeGlitch(is_start_edge, is_start_edge != previous_is_start_edge, elapsed, period))
+    {
+        return;
+    }
+    
+    previous_is_start_edge = is_start_edge;
+    period_start_ticks[is_start_edge] = ticks;
+    
+    //
+    // Everything else is left to SyncEdgeTask(), which has the captured time
+    // to work from.
+    //
+    
+    QueueSyncEdge(is_start_edge, capture_time + ticks);
+}
+
+#else
+
 //
 // Pin change interrupt handler. Reads input clock/sync pulses.
 //
@@ -450,36 +573,37 @@ ISR(PCINT0_vect)
 ISR(PCINT1_vect)
 {
     static uint8_t previous_sync_input = 0;
+    static uint8_t accepted_sync_input = 0;
     uint8_t sync_input = (PINB & (1 << SYNC_IN));
+    uint8_t is_start_edge = (sync_input == 0) ? 1 : 0;
 
     //
-    // Check for a change on the clock/sync input pin.
+    // Check for a change on the clock/sync input pin. The pin level is kept
+    // track of whether the edge makes it past the glitch filter or not, so
+    // every edge is seen going the way it really went; accepted_sync_input is
+    // the level last let through.
     //
 
-    if (sync_input != previous_sync_input)
+    if (sync_input == previous_sync_input)
     {
-        previous_sync_input = sync_input;
+        return;
+    }
+    
+    previous_sync_input = sync_input;
+    
+    if (!IsSyncEdgeGlitch(is_start_edge, sync_input != accepted_sync_input, g_sync_edge_time,
+        g_sync_period_time[is_start_edge]))
+    {
+        accepted_sync_input = sync_input;
 
         //
         // Detect whether this is a falling or rising edge, and start or stop
-        // the tempo counting accordingly.
+        // the tempo counting accordingly. Unlike tap input, the outputs are
+        // only realigned at the start of each bar.
         //
         
-        if (sync_input)
-        {
-            //
-            // See main loop.
-            //
-
-            StopTempoCount();
-        }
-        else
-        {
-            //
-            // See main loop.
-            //
-
-            StartTempoCount();
-        }
+        SyncTempoEdge(is_start_edge, 0);
     }
 }
+
+#endif // SYNC_CAPTURE
@@ -26,11 +26,54 @@
 #define __MAIN_H__
 
 //
-// Fuse bits set to internal 8MHz clock (default), and no clock division (not
-// default).
+// System clock, passed in from the Makefile (CLOCK). Either the internal 8MHz
+// clock (default) with no clock division (not default), or a 20MHz external
+// clock on CLKI. Everything timing related is derived from this.
 //
 
-#define CLOCK_FREQUENCY     			8000000UL
+#ifndef F_CPU
+#define F_CPU                           8000000UL
+#endif
+
+#define CLOCK_FREQUENCY     			F_CPU
+
+//
+// Timer1 trigger rate in Hertz.
+//
+
+#define TIMER1_FREQUENCY                1000UL
+
+//
+// Use the largest Timer1 prescaler that still divides evenly down to exactly
+// 1ms; i.e. 64 at 8MHz, 8 at 20MHz.
+//
+
+#if ((CLOCK_FREQUENCY / 64) % TIMER1_FREQUENCY) == 0
+#define TIMER1_PRESCALER                64UL
+#define TIMER1_CLOCK_SELECT             ((1 << CS11) | (1 << CS10))
+#elif ((CLOCK_FREQUENCY / 8) % TIMER1_FREQUENCY) == 0
+#define TIMER1_PRESCALER                8UL
+#define TIMER1_CLOCK_SELECT             (1 << CS11)
+#else
+#error "No Timer1 prescaler gives an exact 1ms tick at this clock frequency."
+#endif
+
+#define TIMER1_COMPARE                  ((CLOCK_FREQUENCY / TIMER1_PRESCALER / TIMER1_FREQUENCY) - 1)
+
+//
+// Timer1 counts per millisecond; also the resolution of sync input edges in
+// a SYNC_CAPTURE build (8us at 8MHz, 0.4us at 20MHz).
+//
+
+#define TIMER1_TICKS_PER_MS             (TIMER1_COMPARE + 1)
+
+//
+// Functions making up the interrupt handlers are forced inline. Any call from
+// an ISR makes avr-gcc save and restore every call-clobbered register on top
+// of the call itself ("make isr-check" verifies that there are none).
+//
+
+#define ISR_INLINE                      static inline __attribute__((always_inline))
 
 //
 // Pin configuration defines.
@@ -43,12 +86,22 @@
 #define ROTARY_A_IN             		PA4     /* Rotary interrupt input A */
 #define ROTARY_B_IN             		PA5     /* Rotary interrupt input B */
 #define TEMPO_OUT               		PA6     /* Actual multiplier tempo indicator */
-#define LED_OUT	                		PA7     /* Base tempo indicator / sync output */
+#define LFO_POLY_OUT                    PA7     /* OC0B PWM timer output (polyrhythm) */
 #define SPEED_MODE_OUT          		PB0     /* Speed adjust mode indicator */
 #define SYNC_IN                 		PB1     /* External sync signal interrupt input */
 #define LFO_OUT                 		PB2     /* OC0A PWM timer output */
 #define RESET                   		PB3     /* Reset */
 
+//
+// SYNC_CAPTURE (Makefile) moves the sync input to ICP1 (PA7), where Timer1
+// latches the time of each edge in hardware. The polyrhythm output gives up
+// the pin.
+//
+
+#if SYNC_CAPTURE
+#define SYNC_CAPTURE_IN                 PA7     /* ICP1 external sync signal input, replaces LFO_POLY_OUT */
+#endif
+
 //
 // Various boolean flags wrapped up in a single byte to save space (not sure if
 // actually ends up taking less space when compiled).
@@ -61,7 +114,9 @@ typedef struct
     uint8_t is_resetting_mode:1;
     uint8_t has_random_seed:1;
     uint8_t has_received_tap_input:1;
-    uint8_t reserved:3;
+    uint8_t is_alternate_adjust:1;
+    uint8_t is_sync_tempo:1;
+    uint8_t reserved:1;
 } uint8_state_flags;
 
 #endif // __MAIN_H__
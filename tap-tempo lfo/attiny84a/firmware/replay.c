@@ -0,0 +1,62 @@
+//
+// Tap-tempo LFO for 8-bit AVR.
+// 
+// Copyright (C) 2013-2016 Harald Sabro
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Contact info
+// ------------
+// Website: sabrotone.com
+// Email: harald (AT) website 
+//
+
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include "main.h"
+
+#define REPLAY_SESSION_DATA
+#include "replay.h"
+
+#if REPLAY
+
+//
+// Global variables.
+//
+
+volatile uint16_t g_replay_index;
+volatile uint16_t g_replay_delay;
+volatile uint8_t g_replay_encoder_steps;
+volatile int8_t g_replay_encoder_direction;
+
+/*====== Public functions ===================================================== 
+=============================================================================*/
+
+void InitializeReplay()
+{
+    //
+    // Take over the input pins (already pulled high, which is the idle state
+    // for all of them) and wait for the first event.
+    //
+    
+    DDRA |= REPLAY_PINS_A;
+    DDRB |= REPLAY_PINS_B;
+    
+    g_replay_index = 0;
+    g_replay_delay = pgm_read_word(&k_replay_session[0].delay);
+}
+
+#endif // REPLAY
@@ -0,0 +1,193 @@
+//
+// Tap-tempo LFO for 8-bit AVR.
+// 
+// Copyright (C) 2013-2016 Harald Sabro
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Contact info
+// ------------
+// Website: sabrotone.com
+// Email: harald (AT) website 
+//
+
+
+#ifndef __REPLAY_H__
+#define __REPLAY_H__
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include "main.h"
+
+//
+// Input replay (REPLAY=1 in the Makefile). Plays back a recorded (or made up)
+// session of input events with millisecond timing, for reproducing timing
+// problems and comparing changes against the same input every time.
+//
+// The replay drives the input pins themselves, turned into outputs, so every
+// event goes through exactly the same debouncing, pin change interrupts and
+// tempo counting as the real thing. Pin change interrupts trigger on output
+// pins as well.
+//
+// Note: Only run a replay build with nothing connected to the tap, mode,
+//       encoder and sync inputs (or in a simulator), since it drives them.
+//
+// Also see replay_session.py for the session format.
+//
+
+//
+// Sync events go to whichever pin the sync input is on (see SYNC_CAPTURE).
+// Input capture triggers on an output pin as well.
+//
+
+#if SYNC_CAPTURE
+#define REPLAY_PINS_A               ((1 << TAP_IN) | (1 << MODE_IN) | (1 << ROTARY_A_IN) | (1 << ROTARY_B_IN) | (1 << SYNC_CAPTURE_IN))
+#define REPLAY_PINS_B               0
+#define REPLAY_SYNC_PORT            PORTA
+#define REPLAY_SYNC_PIN             SYNC_CAPTURE_IN
+#else
+#define REPLAY_PINS_A               ((1 << TAP_IN) | (1 << MODE_IN) | (1 << ROTARY_A_IN) | (1 << ROTARY_B_IN))
+#define REPLAY_PINS_B               (1 << SYNC_IN)
+#define REPLAY_SYNC_PORT            PORTB
+#define REPLAY_SYNC_PIN             SYNC_IN
+#endif
+
+//
+// Event codes, as used by replay_session.py.
+//
+
+typedef enum
+{
+    ReplayEventWait = 0,            // Nothing; just spans a long gap.
+    ReplayEventTapDown,
+    ReplayEventTapUp,
+    ReplayEventModeDown,
+    ReplayEventModeUp,
+    ReplayEventSyncLow,
+    ReplayEventSyncHigh,
+    ReplayEventEncoderUp,
+    ReplayEventEncoderDown
+} ReplayEvent;
+
+typedef struct
+{
+    uint16_t delay;                 // Milliseconds since the previous event.
+    uint8_t event;
+} ReplayStep;
+
+#if REPLAY
+
+#include "replay_session.h"
+
+extern const ReplayStep k_replay_session[REPLAY_STEP_COUNT] PROGMEM;
+
+//
+// Public function prototypes.
+//
+
+void InitializeReplay();
+
+//
+// Public inline functions. Called from the Timer1 interrupt handler.
+//
+
+extern volatile uint16_t g_replay_index;
+extern volatile uint16_t g_replay_delay;
+extern volatile uint8_t g_replay_encoder_steps;
+extern volatile int8_t g_replay_encoder_direction;
+
+ISR_INLINE void StepReplayEncoder()
+{
+    static const uint8_t encoder_states[4] = { 0x01, 0x00, 0x02, 0x03 };
+    uint8_t state;
+    
+    //
+    // One detent is four quadrature transitions, from rest (both high) back to
+    // rest; A | (B << 1) = 1, 0, 2, 3 turning up and 2, 0, 1, 3 turning down.
+    // Only one transition per millisecond, so that each gets its own pin
+    // change interrupt.
+    //
+    
+    g_replay_encoder_steps--;
+    
+    state = encoder_states[(g_replay_encoder_direction > 0) ? (3 - g_replay_encoder_steps) : ((g_replay_encoder_steps + 3) & 0x03)];
+    
+    PORTA = (PORTA & ~((1 << ROTARY_A_IN) | (1 << ROTARY_B_IN))) | ((state & 0x01) << ROTARY_A_IN) | ((state >> 1) << ROTARY_B_IN);
+}
+
+ISR_INLINE void PlayReplayEvent(uint8_t event)
+{
+    switch (event)
+    {
+        case ReplayEventTapDown:    PORTA &= ~(1 << TAP_IN);    break;
+        case ReplayEventTapUp:      PORTA |= (1 << TAP_IN);     break;
+        case ReplayEventModeDown:   PORTA &= ~(1 << MODE_IN);   break;
+        case ReplayEventModeUp:     PORTA |= (1 << MODE_IN);    break;
+        case ReplayEventSyncLow:    REPLAY_SYNC_PORT &= ~(1 << REPLAY_SYNC_PIN);  break;
+        case ReplayEventSyncHigh:   REPLAY_SYNC_PORT |= (1 << REPLAY_SYNC_PIN);   break;
+        
+        case ReplayEventEncoderUp:
+        case ReplayEventEncoderDown:
+            
+            g_replay_encoder_direction = (event == ReplayEventEncoderUp) ? 1 : -1;
+            g_replay_encoder_steps = 4;
+            break;
+        
+        default:
+            
+            break;
+    }
+}
+
+ISR_INLINE void ReplayTick()
+{
+    //
+    // Called every millisecond. Finish off any encoder detent in progress,
+    // then play every event that is due (several may share a millisecond).
+    //
+    
+    if (g_replay_encoder_steps > 0)
+    {
+        StepReplayEncoder();
+    }
+    
+    if (g_replay_delay > 0)
+    {
+        g_replay_delay--;
+        return;
+    }
+    
+    while (g_replay_index < REPLAY_STEP_COUNT)
+    {
+        PlayReplayEvent(pgm_read_byte(&k_replay_session[g_replay_index].event));
+        
+        if (++g_replay_index >= REPLAY_STEP_COUNT)
+        {
+            break;
+        }
+        
+        g_replay_delay = pgm_read_word(&k_replay_session[g_replay_index].delay);
+        
+        if (g_replay_delay > 0)
+        {
+            g_replay_delay--;
+            break;
+        }
+    }
+}
+
+#endif // REPLAY
+
+#endif // __REPLAY_H__
@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+
+#
+# Convert an input session (see below) to the replay_session.h header used by
+# a REPLAY=1 build of the attiny84a firmware (see replay.h).
+#
+# Usage: replay_session.py <session.txt> [replay_session.h]
+#
+# Session format; one event per line, '#' starts a comment:
+#
+#   <time> <event> [<argument>]
+#
+# <time> is in milliseconds from the start of the replay, and must never go
+# backwards. Events:
+#
+#   tap down | tap up           Tap switch pressed / released.
+#   mode down | mode up         Mode switch pressed / released.
+#   sync low | sync high        Sync input level.
+#   encoder <+n | -n>           Turn the encoder n detents up or down. Each
+#                               detent takes 4ms to play out.
+#   adc <channel> <value>       Pot reading (attiny85 only). Not replayable on
+#                               the attiny84a; skipped with a warning.
+#
+
+import sys
+
+EVENT_CODES = {
+    'wait': 0,
+    ('tap', 'down'): 1,
+    ('tap', 'up'): 2,
+    ('mode', 'down'): 3,
+    ('mode', 'up'): 4,
+    ('sync', 'low'): 5,
+    ('sync', 'high'): 6,
+    ('encoder', 'up'): 7,
+    ('encoder', 'down'): 8,
+}
+
+ENCODER_DETENT_MS = 4
+MAX_DELAY = 0xffff
+
+
+def parse_session(lines, name):
+    events = []
+    previous_time = 0
+    encoder_busy_until = 0
+
+    for number, line in enumerate(lines, 1):
+        line = line.split('#', 1)[0].split()
+        if not line:
+            continue
+
+        where = '%s:%d' % (name, number)
+
+        try:
+            time = int(line[0])
+        except ValueError:
+            sys.exit('%s: bad time "%s"' % (where, line[0]))
+
+        if time < previous_time:
+            sys.exit('%s: time goes backwards' % where)
+        previous_time = time
+
+        kind = line[1] if len(line) > 1 else ''
+        argument = line[2] if len(line) > 2 else ''
+
+        if kind == 'encoder':
+            try:
+                detents = int(argument)
+            except ValueError:
+                sys.exit('%s: bad encoder step "%s"' % (where, argument))
+
+            if time < encoder_busy_until:
+                sys.exit('%s: encoder turned again before the previous detent finished' % where)
+
+            direction = 'up' if detents > 0 else 'down'
+            for i in range(abs(detents)):
+                events.append((time + (i * ENCODER_DETENT_MS), EVENT_CODES[('encoder', direction)]))
+            encoder_busy_until = time + (abs(detents) * ENCODER_DETENT_MS)
+
+        elif kind == 'adc':
+            sys.stderr.write('%s: warning: adc events are not replayable on the attiny84a, skipped\n' % where)
+
+        elif (kind, argument) in EVENT_CODES:
+            events.append((time, EVENT_CODES[(kind, argument)]))
+
+        else:
+            sys.exit('%s: unknown event "%s"' % (where, ' '.join(line[1:])))
+
+    events.sort(key=lambda event: event[0])
+    return events
+
+
+def to_steps(events):
+    steps = []
+    previous_time = 0
+
+    for time, code in events:
+        delay = time - previous_time
+
+        #
+        # The firmware keeps delays in 16 bits; span longer gaps with waits.
+        #
+
+        while delay > MAX_DELAY:
+            steps.append((MAX_DELAY, EVENT_CODES['wait']))
+            delay -= MAX_DELAY
+
+        steps.append((delay, code))
+        previous_time = time
+
+    return steps
+
+
+def write_header(steps, source, out):
+    out.write('//\n')
+    out.write('// Generated by replay_session.py from %s. Do not edit.\n' % source)
+    out.write('//\n\n')
+    out.write('#ifndef __REPLAY_SESSION_H__\n')
+    out.write('#define __REPLAY_SESSION_H__\n\n')
+    out.write('#define REPLAY_STEP_COUNT           %d\n\n' % len(steps))
+    out.write('#ifdef REPLAY_SESSION_DATA\n\n')
+    out.write('const ReplayStep k_replay_session[REPLAY_STEP_COUNT] PROGMEM =\n')
+    out.write('{\n')
+    out.write(',\n'.join('    { %5d, %d }' % step for step in steps))
+    out.write('\n};\n\n')
+    out.write('#endif // REPLAY_SESSION_DATA\n\n')
+    out.write('#endif // __REPLAY_SESSION_H__\n')
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        sys.exit('usage: %s <session.txt> [replay_session.h]' % sys.argv[0])
+
+    with open(sys.argv[1]) as f:
+        steps = to_steps(parse_session(f.readlines(), sys.argv[1]))
+
+    if not steps:
+        sys.exit('%s: no events to replay' % sys.argv[1])
+
+    if len(sys.argv) == 3:
+        with open(sys.argv[2], 'w') as out:
+            write_header(steps, sys.argv[1], out)
+    else:
+        write_header(steps, sys.argv[1], sys.stdout)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,191 @@
+//
+// Tap-tempo LFO for 8-bit AVR.
+// 
+// Copyright (C) 2013-2016 Harald Sabro
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Contact info
+// ------------
+// Website: sabrotone.com
+// Email: harald (AT) website 
+//
+
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+#include "main.h"
+#include "signaling.h"
+#include "switching.h"
+#include "stats.h"
+#include "song.h"
+#include "scheduler.h"
+
+//
+// Defines and structs.
+//
+
+typedef TaskResult (*TaskFunction)();
+
+typedef struct
+{
+    TaskFunction function;
+    uint16_t budget;
+} TaskDescriptor;
+
+//
+// The task functions and how long each run is expected to take at most, in
+// Task order. The budgets are estimates from instruction counts of the
+// division heavy paths; GetTaskMaxTicks() tells what they actually take.
+//
+
+static const TaskDescriptor k_task_descriptor[TaskCount] PROGMEM =
+{
+#if SYNC_CAPTURE
+    { SyncEdgeTask,             TASK_BUDGET_US(500) },  // A single edge per run; two phase divisions on a downbeat.
+#endif
+    { RecalculateTempoTask,     TASK_BUDGET_US(500) },  // 32-bit divisions for all three duty cycles (and the phase, on a ratio change).
+    { ResetSelectionModeTask,   TASK_BUDGET_US(750) },  // Ratio and alignment setup, plus the above.
+#if SONG_MODE
+    { SongPrefetchTask,         TASK_BUDGET_US(1500) }, // Reading the whole map (on a restart), or an entry and two divisions.
+#endif
+    { FlushStatsTask,           TASK_BUDGET_US(100) }   // A single EEPROM byte per run.
+};
+
+//
+// Local function prototypes.
+//
+
+uint16_t ReadSchedulerTicks();
+
+//
+// Global variables.
+//
+
+volatile uint8_t g_pending_tasks;
+volatile uint16_t g_scheduler_ms_count;
+
+uint8_t g_task_overrun_count[TaskCount];
+uint16_t g_task_max_ticks[TaskCount];
+
+/*====== Public functions ===================================================== 
+=============================================================================*/
+
+void RunScheduledTask()
+{
+    TaskFunction function;
+    TaskResult result;
+    uint16_t start_ticks;
+    uint16_t elapsed_ticks;
+    uint8_t task;
+    
+    //
+    // Find the highest priority pending task, if any, and take it off the
+    // pending list before it runs so that anything scheduling it again in the
+    // meantime isn't lost.
+    //
+    
+    for (task = 0; task < TaskCount; task++)
+    {
+        if (g_pending_tasks & (1 << task))
+        {
+            break;
+        }
+    }
+    
+    if (task >= TaskCount)
+    {
+        return;
+    }
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        g_pending_tasks &= ~(1 << task);
+    }
+    
+    //
+    // Run a single slice, and put the task back on the list if it has more to
+    // do.
+    //
+    
+    function = (TaskFunction)pgm_read_word(&k_task_descriptor[task].function);
+    
+    start_ticks = ReadSchedulerTicks();
+    result = function();
+    elapsed_ticks = ReadSchedulerTicks() - start_ticks;
+    
+    if (result == TaskResultYield)
+    {
+        ScheduleTask(task);
+    }
+    
+    //
+    // Keep track of the worst case, and of how often the budget was exceeded.
+    //
+    
+    if (elapsed_ticks > g_task_max_ticks[task])
+    {
+        g_task_max_ticks[task] = elapsed_ticks;
+    }
+    
+    if ((elapsed_ticks > pgm_read_word(&k_task_descriptor[task].budget)) && (g_task_overrun_count[task] < 0xff))
+    {
+        g_task_overrun_count[task]++;
+    }
+}
+
+uint8_t GetTaskOverrunCount(Task task)
+{
+    return g_task_overrun_count[task];
+}
+
+uint16_t GetTaskMaxTicks(Task task)
+{
+    return g_task_max_ticks[task];
+}
+
+/*====== Local functions ====================================================== 
+=============================================================================*/
+
+uint16_t ReadSchedulerTicks()
+{
+    uint16_t ms_count;
+    uint16_t timer_count;
+    
+    //
+    // Timer1 ticks since some arbitrary point; the millisecond count times the
+    // ticks per millisecond, plus the current Timer1 count. This wraps around
+    // at 16 bits, which is fine as long as differences are taken.
+    //
+    // If the compare match happened but the interrupt hasn't run yet (it
+    // can't, in here) the millisecond count is one behind. Only count it if
+    // the timer count has actually restarted, since the match may have
+    // happened just after reading it.
+    //
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        timer_count = TCNT1;
+        ms_count = g_scheduler_ms_count;
+        
+        if ((TIFR1 & (1 << OCF1A)) && (timer_count < (TIMER1_COMPARE / 2)))
+        {
+            ms_count++;
+        }
+    }
+    
+    return (ms_count * (uint16_t)(TIMER1_COMPARE + 1)) + timer_count;
+}
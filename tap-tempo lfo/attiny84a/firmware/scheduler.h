@@ -0,0 +1,107 @@
+//
+// Tap-tempo LFO for 8-bit AVR.
+// 
+// Copyright (C) 2013-2016 Harald Sabro
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Contact info
+// ------------
+// Website: sabrotone.com
+// Email: harald (AT) website 
+//
+
+
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "main.h"
+
+//
+// Deferred work. Anything expensive is marked as pending (from an interrupt
+// handler or otherwise), and the main loop runs one pending task per pass,
+// in priority order, in between polling the switches. Lower value means
+// higher priority.
+//
+
+typedef enum
+{
+#if SYNC_CAPTURE
+    TaskSyncEdge,
+#endif
+    TaskRecalculateTempo,
+    TaskModeReset,
+#if SONG_MODE
+    TaskSongPrefetch,
+#endif
+    TaskStatsFlush,
+    TaskCount
+} Task;
+
+//
+// A task either finishes in one go, or does a bounded slice of the work and
+// yields to be run again on a later pass (after any higher priority tasks).
+//
+
+typedef enum
+{
+    TaskResultDone = 0,
+    TaskResultYield
+} TaskResult;
+
+//
+// Each task declares how long a single run (or slice) may take, in Timer1
+// ticks; 8us at 8MHz, 0.4us at 20MHz.
+//
+
+#define TASK_BUDGET_US(microseconds)    ((uint16_t)(((microseconds) * (CLOCK_FREQUENCY / TIMER1_PRESCALER)) / 1000000UL))
+
+//
+// Public function prototypes.
+//
+
+void RunScheduledTask();
+uint8_t GetTaskOverrunCount(Task task);
+uint16_t GetTaskMaxTicks(Task task);
+
+//
+// Public inline functions. Safe to use from interrupt handlers.
+//
+
+extern volatile uint8_t g_pending_tasks;
+extern volatile uint16_t g_scheduler_ms_count;
+
+ISR_INLINE void ScheduleTask(Task task)
+{
+    uint8_t sreg = SREG;
+    
+    //
+    // Just sets the pending bit; running the same task twice before it gets
+    // to run only runs it once.
+    //
+    
+    cli();
+    g_pending_tasks |= (1 << task);
+    SREG = sreg;
+}
+
+ISR_INLINE void CountSchedulerTime()
+{
+    g_scheduler_ms_count++;
+}
+
+#endif // __SCHEDULER_H__
@@ -23,11 +23,17 @@
 //
 
 #include <avr/io.h>
-#include <stdlib.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
 #include <stdbool.h>
 
 #include "main.h"
 #include "signaling.h"
+#include "scheduler.h"
+#include "song.h"
+#include "taptempo.h"
+#include "tempo.h"
 
 //
 // Available waveforms.
@@ -42,6 +48,8 @@ typedef enum
     WaveformSquare,
 	WaveformQuadPulse,
     WaveformRandom,
+    WaveformNoise,
+    WaveformSmoothNoise,
     WaveformCount           // Dummy entry to get the enum count.
 } Waveform;
 
@@ -65,50 +73,59 @@ typedef enum
 } Multiplier;
 
 //
-// Calculate duty cycle for multiplier[x] by taking the base duty cycle and
-// multiplying by the correct ratio.
+// Each multiplier is an exact N/M ratio; N output cycles for every M base
+// tempo cycles. The duty cycle for multiplier[x] is calculated by taking the
+// base duty cycle, multiplying by N and dividing by M.
+//
+// Each multiplier also aligns with the base tempo every M base tempo cycles
+// (less if the ratio can be reduced), e.g. every 3/4 for a dotted quarter.
 //
 
-static const float k_multiplier_ratio[MultiplierCount] =
+typedef struct
 {
-    0.25,       // Whole note.              (1/4) = 0.25 rate
-    0.333334,   // Dotted half note.        (1/3) = ~0.333334 rate
-    0.5,        // Half note.               (1/2) = 0.5 rate
-    0.666667,   // Dotted quarter note.     (2/3) = ~0.666667 rate
-    1.0,        // Quarter note.            (1/1) = 1 rate
-    1.333334,   // Dotted eighth note.      (4/3) = ~1.333334 rate
-    2.0,        // Eighth note.             (2/1) = 2 rate
-    2.666667,   // Dotted sixteenth note.   (8/3) = ~2,666667 rate
-    3.0,        // Triplet note.            (3/1) = 3 rate
-    4.0         // Sixteenth note.          (4/1) = 4 rate
-};
+    uint8_t numerator;
+    uint8_t denominator;
+} MultiplierRatio;
 
-static const uint8_t k_multiplier_alignment[MultiplierCount] =
-{
-    4,  // Whole note.              Matches base tempo at 4/4.
-    3,  // Dotted half note.        Matches base tempo at 3/4. 
-    2,  // Half note.               Matches base tempo at 2/4.
-    3,  // Dotted quarter note.     Matches base tempo at 3/4.
-    1,  // Quarter note.            Base tempo. 
-    3,  // Dotted eighth note.      Matches base tempo at 3/4.
-    1,  // Eighth note.             Matches base tempo at 1/4.
-    3,  // Dotted sixteenth note.   Matches base tempo at 3/4.
-    2,  // Triplet note.            Matches base tempo at 1/4.
-    1   // Sixteenth note.          Matches base tempo at 1/4.
+static const MultiplierRatio k_multiplier_ratio[MultiplierCount] PROGMEM =
+{
+    { 1, 4 },   // Whole note.              Matches base tempo at 4/4.
+    { 1, 3 },   // Dotted half note.        Matches base tempo at 3/4.
+    { 1, 2 },   // Half note.               Matches base tempo at 2/4.
+    { 2, 3 },   // Dotted quarter note.     Matches base tempo at 3/4.
+    { 1, 1 },   // Quarter note.            Base tempo.
+    { 4, 3 },   // Dotted eighth note.      Matches base tempo at 3/4.
+    { 2, 1 },   // Eighth note.             Matches base tempo at 1/4.
+    { 8, 3 },   // Dotted sixteenth note.   Matches base tempo at 3/4.
+    { 3, 1 },   // Triplet note.            Matches base tempo at 1/4.
+    { 4, 1 }    // Sixteenth note.          Matches base tempo at 1/4.
 };
 
+//
+// Upper limit of either part of a user entered N/M ratio. Keeps the least
+// common multiple of the two outputs' alignment periods within 8 bits.
+//
+
+#define RATIO_MAX                       16
 
 //
-// Number of base tempo counts between each time all multipliers align.
+// The outputs' places in g_alignment; their active ratios, and where each is
+// within its alignment period (see lib/taptempo/tempo.h).
 //
 
-#define MULTIPLIER_ALIGNMENT_OFFSET     12
+#define ALIGNMENT_LFO                   0
+#define ALIGNMENT_POLY                  1
 
 //
-// Book keeping defines.
+// Upper limit of the number of beats (sync pulse edges) in a bar when
+// running off an external clock.
 //
 
-#define TEMPO_TO_FREQUENCY              1000.0f
+#define SYNC_BAR_LENGTH_MAX             16
+
+//
+// Book keeping defines.
+//
 
 #define WAVEFORM_RESOLUTION             256
 
@@ -121,7 +138,7 @@ static const uint8_t k_multiplier_alignment[MultiplierCount] =
 //       of the other waveforms.
 //
 
-static const uint8_t k_sine_table[WAVEFORM_RESOLUTION/4] =
+static const uint8_t k_sine_table[WAVEFORM_RESOLUTION/4] PROGMEM =
 {
       0,   0,   0,   0,   1,   1,   1,   2,   2,   3,   4,   5,   5,   6,   7,   9,
      10,  11,  12,  14,  15,  17,  18,  20,  21,  23,  25,  27,  29,  31,  33,  35,
@@ -135,77 +152,348 @@ static const uint8_t k_sine_table[WAVEFORM_RESOLUTION/4] =
 // 8MHz / 128 =  62.50kHz
 // 8MHz /  64 = 125.00kHz
 //
+// 20MHz / 256 = 78.125kHz
+//
 
 #define TIMER0_SAMPLE_RATE              (CLOCK_FREQUENCY / WAVEFORM_RESOLUTION)
-#define DUTY_CYCLE_DIVISOR              (0x100000000 / TIMER0_SAMPLE_RATE)
+
+//
+// The constant part of the duty cycle (phase step per sample) for a tempo,
+// worked out here at compile time, leaving a single integer division at run
+// time (see lib/taptempo/tempo.h).
+//
+
+#define DUTY_CYCLE_DIVIDEND             TEMPO_DUTY_CYCLE_DIVIDEND(CLOCK_FREQUENCY, WAVEFORM_RESOLUTION)
+
+//
+// BPM_QUANTIZE (Makefile) snaps the tempo to the nearest whole BPM (1) or half
+// BPM (2); 0 leaves it at the millisecond count. The duty cycle is then worked
+// out from the BPM instead of the milliseconds, so a tempo like 128 BPM
+// (468.75ms) comes out exact, and the same on every unit.
+//
+
+#ifndef BPM_QUANTIZE
+#define BPM_QUANTIZE                    0
+#endif
+
+#if BPM_QUANTIZE
+#define BPM_QUANTIZE_DIVIDEND           TEMPO_BPM_QUANTIZE_DIVIDEND(BPM_QUANTIZE)
+#define BPM_STEP_DUTY_CYCLE             TEMPO_BPM_STEP_DUTY_CYCLE(CLOCK_FREQUENCY, WAVEFORM_RESOLUTION, BPM_QUANTIZE)
+#endif
+
+//
+// With SYNC_CAPTURE (Makefile) the sync input period is measured in Timer1
+// counts, and the duty cycle is 2^32 * SYNC_CAPTURE_SCALE / counts; i.e. the
+// number of Timer1 counts per sample, times 2^32. A power of two (the
+// prescaler divides 256), and too big for 32 bits, so it's kept apart.
+//
+// Period changes of less than SYNC_CAPTURE_TOLERANCE counts (an eighth of a
+// millisecond) are taken as jitter and left alone, like the 2ms in
+// SetBaseTempo().
+//
+
+// The period is checked against the LFO limits in counts too, as those
+// that round to LFO_MAX_TEMPO - LFO_MIN_TEMPO milliseconds, so it doesn't take
+// a division. The milliseconds are worked out later, in
+// RecalculateTempoTask().
+//
+
+#if SYNC_CAPTURE
+#define SYNC_CAPTURE_SCALE              (WAVEFORM_RESOLUTION / TIMER1_PRESCALER)
+#define SYNC_CAPTURE_TOLERANCE          (TIMER1_TICKS_PER_MS / 8)
+#define SYNC_CAPTURE_MIN_TICKS          (((uint32_t)LFO_MAX_TEMPO * TIMER1_TICKS_PER_MS) - (TIMER1_TICKS_PER_MS / 2))
+#define SYNC_CAPTURE_MAX_TICKS          ((((uint32_t)LFO_MIN_TEMPO + 1) * TIMER1_TICKS_PER_MS) - (TIMER1_TICKS_PER_MS / 2) - 1)
+#endif
+
+//
+// Outputs whose phase is to be brought in line with a new ratio, along with
+// the new duty cycles (see RecalculateRealignedTempo()).
+//
+
+#define REALIGN_LFO                     (1 << ALIGNMENT_LFO)
+#define REALIGN_POLY                    (1 << ALIGNMENT_POLY)
+
+//
+// The "random" waveform picks one of a few levels each cycle. Keeping only the
+// top bits of a random byte avoids a multiply (no hardware MUL).
+//
 
 #define WAVEFORM_RANDOM_STEP_COUNT      8
-#define WAVEFORM_STEP_SIZE              (0xff / WAVEFORM_RANDOM_STEP_COUNT)
+#define WAVEFORM_RANDOM_MASK            ((uint8_t)~((0x100 / WAVEFORM_RANDOM_STEP_COUNT) - 1))
+
+//
+// Noise is generated by a 16-bit xorshift (7, 9, 8; period 2^16 - 1), stepped
+// whenever the table index crosses a step boundary. A single LFSR shift per
+// output byte only moves one new bit in, so consecutive values formed a
+// staircase; each xorshift step mixes the whole register instead. The smooth
+// variant runs the result through a one-pole low-pass filter, updated once
+// per table index step; i.e. level += (target - level) / 2^shift.
+//
+
+#define NOISE_SMOOTH_SHIFT              2
+
+//
+// Event driven DDS (EVENT_DRIVEN_DDS=1 in the Makefile). At slow tempos the
+// table index only moves every few hundred Timer0 overflows, and nothing
+// about the output changes in between. So rather than updating every
+// overflow, the sample update works out how many overflows (a power of two,
+// up to 2^DDS_MAX_SKIP_SHIFT) are guaranteed not to move any table index, and
+// a bare countdown handler skips all but the last of them. The skipped
+// samples are then added to the phase accumulators in one go, so the output
+// is exactly the same as when updating every overflow.
+//
+// Anything changing the phase accumulators, duty cycles or what gets plotted
+// from outside the timer interrupt must call SyncDds() first.
+//
+
+#define DDS_MAX_SKIP_SHIFT              7
+
+#if EVENT_DRIVEN_DDS
+#define TIM0_OVF_SAMPLE_vect            __vector_dds_sample
+#define DDS_STEP(duty_cycle)            ((duty_cycle) << g_dds_skip_shift)
+#else
+#define DDS_STEP(duty_cycle)            (duty_cycle)
+#endif
+
+//
+// Waveform render descriptors. Rather than keeping a full 256 byte plot of
+// the current waveform in RAM, each waveform is described by how to draw a
+// single point of it from the table index:
+//
+// - Ramps are the index itself, optionally inverted (x = i ^ mask).
+// - The triangle is a ramp at twice the rate, mirrored for the second half.
+// - Square and pulse waves are either min or max depending on a subset of the
+//   index bits (x = max when (i & mask) == match).
+// - The sine is looked up in the quarter wave table above and mirrored.
+// - "Random" is the current random number.
+// - Noise takes a new random value each time any of the masked index bits
+//   change; e.g. 64 times per cycle for 0xfc. A non-zero match smoothes it.
+//
+// The depth setting is then applied to whatever value comes out of this.
+//
+// Note: None of the current waveforms need a full RAM table, but a truly
+//       arbitrary waveform would need one.
+//
+
+typedef enum
+{
+    RenderRamp = 0,
+    RenderTriangle,
+    RenderPulse,
+    RenderSine,
+    RenderRandom,
+    RenderNoise
+} RenderMode;
+
+typedef struct
+{
+    uint8_t mode;
+    uint8_t mask;
+    uint8_t match;
+} WaveformRender;
+
+typedef struct
+{
+    uint8_t index;
+    uint8_t target;
+    uint8_t level;
+} NoiseState;
+
+//
+// Everything the Timer0 handler touches on each sample lives in one struct,
+// in the order the handler gets to it. The handler then only needs a single
+// pointer register (Y or Z) and reaches every field with a one word LDD/STD
+// plus displacement, rather than a two word LDS/STS with the absolute address
+// each time. The displacement only goes up to 63, so keep the struct (and
+// anything hot) within the first 64 bytes.
+//
+// Note: The AVR has no alignment requirements, so there is no padding to
+//       worry about.
+//
+// Note 2: The EVENT_DRIVEN_DDS skip counters stay separate globals, since the
+//         bare countdown handler deliberately has no pointer register set up.
+//
+
+typedef struct
+{
+    uint32_t phase_accumulator;
+    uint32_t duty_cycle;
+    uint8_t table_index;
+} DdsChannel;
+
+typedef struct
+{
+    DdsChannel channel;
+    WaveformRender render;
+    NoiseState noise;
+} DdsOutput;
+
+typedef struct
+{
+    DdsChannel base;            // Base tempo (for the tempo count and alignment).
+    DdsOutput lfo;              // Main LFO output (OC0A).
+    DdsOutput poly;             // Polyrhythm output (OC0B).
+    uint8_t depth_ratio;
+    uint8_t depth_offset;
+    uint8_t depth_scale;
+    uint8_t random_number;      // Used with the "random" waveform.
+    uint16_t noise_register;    // Random source for all of the above and the noise waveforms.
+} DdsState;
+
+static const WaveformRender k_waveform_render[WaveformCount] PROGMEM =
+{
+    { RenderSine,       0x00, 0x00 },   // Sine.
+    { RenderRamp,       0x00, 0x00 },   // Ramp up.
+    { RenderRamp,       0xff, 0x00 },   // Ramp down.
+    { RenderTriangle,   0x00, 0x00 },   // Triangle.
+    { RenderPulse,      0x80, 0x80 },   // Square.
+    { RenderPulse,      0x90, 0x00 },   // Quad pulse; max for 0x00-0x0f, 0x20-0x2f etc.
+    { RenderRandom,     0x00, 0x00 },   // Random.
+    { RenderNoise,      0xfc, 0x00 },   // Noise; 64 new values per cycle.
+    { RenderNoise,      0xf0, 0x01 }    // Smooth noise; 16 new values per cycle, filtered.
+};
 
 //
 // Local function prototypes.
 //
 
+void BeginTempoCount();
+void EndTempoCount();
 void ResetBaseTempo();
 void RecalculateTempo();
+void RecalculateRealignedTempo(uint8_t outputs);
+uint32_t CalcBaseDutyCycle(uint16_t tempo);
+#if SYNC_CAPTURE
+void SyncCapturedEdge(uint8_t is_start_edge, uint32_t time);
+uint32_t ReadSyncCaptureTime();
+void SetCapturedTempo(uint32_t ticks);
+uint32_t CalcCapturedDutyCycle(uint32_t ticks);
+#endif
 void AdjustPhaseAccumulation();
-uint8_t CalcSignalDepth(uint8_t);
-
+void AdjustPolyPhaseAccumulation();
+void LoadMultiplierRatio(uint8_t output, Multiplier multiplier);
+Waveform StepWaveform(Waveform waveform, int8_t change_value);
+Multiplier StepMultiplier(Multiplier multiplier, int8_t change_value);
+void LoadWaveformRender(volatile WaveformRender *render, Waveform waveform);
+void SyncDds();
+ISR_INLINE volatile DdsState *LoadDdsPointer();
+ISR_INLINE void PlotWaveform(volatile DdsState *dds);
+#if EVENT_DRIVEN_DDS
+ISR_INLINE void ScheduleNextSample(volatile DdsState *dds);
+#endif
+ISR_INLINE uint8_t RenderWaveform(volatile DdsState *dds, volatile DdsOutput *output);
+ISR_INLINE void StepRandomNumber(volatile DdsState *dds);
+ISR_INLINE uint8_t StepNoise(volatile DdsState *dds);
+ISR_INLINE uint8_t ScaleDepth(uint8_t value, uint8_t scale);
 
 //
 // Global variables.
 //
 
-volatile uint8_t g_random_number;   // Used with the "random" waveform.
+volatile DdsState g_dds =
+{
+    .base = { .table_index = 0xff },
+    .lfo = { .render = { RenderSine, 0x00, 0x00 } },
+    .poly = { .render = { RenderSine, 0x00, 0x00 } },
+    .depth_ratio = 100,
+    .noise_register = 0xace1
+};
 
 volatile uint16_t g_base_tempo;
 
-volatile uint32_t g_base_duty_cycle;
-volatile uint8_t g_base_table_index = 0xff;
-volatile uint32_t g_base_phase_accumulator;
-volatile uint32_t g_duty_cycle;
-volatile uint8_t g_table_index = 0;
-volatile uint32_t g_phase_accumulator;
+volatile SyncTime g_sync_edge_time = SYNC_TIME_MAX;
+volatile SyncTime g_sync_period_time[2] = { SYNC_TIME_MAX, SYNC_TIME_MAX };
+volatile SyncTime g_sync_period[2];
+volatile uint8_t g_has_rejected_sync_period[2];
+
+#if SYNC_CAPTURE
+//
+// The base tempo in Timer1 counts when it came from a captured sync period,
+// otherwise 0. Used over g_base_tempo while there's no speed adjustment, and
+// g_base_tempo is worked out from it in RecalculateTempoTask().
+//
+
+volatile uint32_t g_base_tempo_ticks;
+
+volatile uint32_t g_sync_capture_start_time;
 
-volatile uint8_t g_multiplier_alignment_index;
+volatile uint32_t g_sync_capture_time;
+volatile uint32_t g_sync_edge_queue_time[SYNC_EDGE_QUEUE_SIZE];
+volatile uint8_t g_sync_edge_queue_is_start;
+volatile uint8_t g_sync_edge_queue_head;
+volatile uint8_t g_sync_edge_queue_count;
+#endif
+
+volatile TempoAlignment g_alignment = TEMPO_ALIGNMENT_INIT(1);
+
+volatile uint8_t g_sync_beat_index;
+volatile uint8_t g_sync_bar_length = 1;
+
+volatile uint8_t g_realign_pending;
 
 volatile Waveform g_waveform = WaveformSine;
 volatile Multiplier g_multiplier = MultiplierQuarter;
+
+//
+// Polyrhythm output. Runs off the same base tempo as the main LFO output, but
+// with its own multiplier and waveform.
+//
+
+volatile Waveform g_poly_waveform = WaveformSine;
+volatile Multiplier g_poly_multiplier = MultiplierQuarter;
 volatile int16_t g_tempo_adjust_offset;
 
-volatile uint8_t g_depth_ratio = 100;
-volatile uint8_t g_depth_offset = 0;
-volatile uint8_t g_depth_table[WAVEFORM_RESOLUTION];
+#if EVENT_DRIVEN_DDS
+volatile uint8_t g_dds_skip_count = 1;  // Overflows left until the next sample update (see Timer0 handler).
+volatile uint8_t g_dds_skip_shift = 0;  // 2^shift overflows between the previous and next sample update.
+#endif
+
+//
+// Tap interval tracking, shared with the host side tools (lib/taptempo). Only
+// touched from SetBaseTempo() and InitializeSignaling(), which both run with
+// interrupts disabled.
+//
 
-extern volatile uint8_state_flags g_state;
-extern volatile uint16_t g_tempo_ms_count;
+TapTempo g_tap_tempo;
 
 /*====== Public functions ===================================================== 
 =============================================================================*/
 
-
+void InitializeSignaling()
+{
+    TapTempoInitialize(&g_tap_tempo, LFO_MAX_TEMPO, LFO_MIN_TEMPO);
+}
 
 void SetBaseTempo(uint16_t milliseconds)
 {
     //
-    // Do some boundary checking on the requested frequency. We're only going
-    // to accept frequencies in the range of 0.1Hz - 20Hz.
+    // The interval goes through the shared tap tempo tracker, which only
+    // accepts frequencies in the range of 0.1Hz - 20Hz, and averages the tap
+    // intervals with TAP_AVERAGING (Makefile). Otherwise, and for sync input,
+    // it starts afresh every time and hands the interval straight back; no
+    // division involved.
     //
     
-    if ((milliseconds > LFO_MIN_TEMPO) || (milliseconds < LFO_MAX_TEMPO))
+#if TAP_AVERAGING
+    if (g_state.is_sync_tempo == 1)
+#endif
+    {
+        InitializeSignaling();
+    }
+    
+    milliseconds = TapTempoAddInterval(&g_tap_tempo, milliseconds);
+    
+    if (milliseconds == 0)
     {
         return;
     }
     
     //
     // No need to recalculate if the new tempo count is just a few milliseconds
-    // off (would be typical when running off an external clock pulse).
-    //
-    // 2ms +/- seems to eliminate any syncing irregularities when clocked from
-    // an external tap-tempo chip.
+    // off (see TEMPO_CHANGE_TOLERANCE).
     //
     
-    if ((g_base_tempo > (milliseconds + 2)) || (g_base_tempo < (milliseconds - 2)))
+    if (TempoIsChange(g_base_tempo, milliseconds))
     {
         //
         // Store the new base tempo and recalculate how that affects the actual
@@ -214,6 +502,9 @@ void SetBaseTempo(uint16_t milliseconds)
         
         g_base_tempo = milliseconds;
         g_tempo_adjust_offset = 0;
+#if SYNC_CAPTURE
+        g_base_tempo_ticks = 0;
+#endif
         
         RecalculateTempo();
     }        
@@ -225,12 +516,11 @@ void StartTempoCount()
     // Sync the LFO output and start the tempo counting.
     //
     
-    g_tempo_ms_count = 0;
-    g_state.is_counting_tempo = 1;
+    g_state.is_sync_tempo = 0;
+    BeginTempoCount();
     
     ResetBaseTempo();
     AlignWaveform();
-	
 }
 
 void StopTempoCount()
@@ -239,121 +529,146 @@ void StopTempoCount()
     // Set the new tempo and reset the tempo counting state.
     //
     
-    if (g_state.is_counting_tempo == 1)
-    {
-        g_state.is_counting_tempo = 0;
-        
-        SetBaseTempo(g_tempo_ms_count);
-        g_tempo_ms_count = 0;
-    }
+    EndTempoCount();
     
     ResetBaseTempo();
     AlignWaveform();
+}
 
+void SyncTempoEdge(uint8_t is_start_edge, uint32_t base_phase)
+{
+    //
+    // Every edge on the sync input is a beat. Start and stop edges take turns
+    // to estimate the tempo, same as with tap input.
+    //
+    // The base tempo restarts from base_phase on a downbeat; how far it has
+    // got since the edge, if the edge is handled late (see SyncEdgeTask()).
+    //
+    
+    if (is_start_edge)
+    {
+        g_state.is_sync_tempo = 1;
+        BeginTempoCount();
+    }
+    else
+    {
+        EndTempoCount();
+    }
+    
+    //
+    // Only do the hard phase realignment on the downbeat; i.e. the first beat
+    // of every bar. The beats in between leave the outputs running freely, so
+    // slow waveforms aren't chopped up by every clock tick, and a missed
+    // pulse doesn't upset the multiplier alignment bookkeeping.
+    //
+    // The downbeat itself is aligned first, and the outputs put where they
+    // should be relative to the (now reset) base tempo, which also takes care
+    // of the multipliers that don't line up with the bar. Since
+    // AlignWaveform() only counts one beat, the rest of the bar is skipped
+    // over after that, so the next downbeat lands on the next bar's first
+    // alignment beat.
+    //
+    
+    if (g_sync_beat_index == 0)
+    {
+        ResetBaseTempo();
+        g_dds.base.phase_accumulator = base_phase;
+        AlignWaveform();
+        AdjustPhaseAccumulation();
+        AdjustPolyPhaseAccumulation();
+        TempoSkipAlignmentBeats(&g_alignment, g_sync_bar_length - 1);
+    }
+    
+    if (++g_sync_beat_index >= g_sync_bar_length)
+    {
+        g_sync_beat_index = 0;
+    }
 }
 
-void TempoCountTimeout()
+#if SYNC_CAPTURE
+TaskResult SyncEdgeTask()
 {
+    uint8_t head;
+    uint8_t is_start_edge;
+    uint32_t time;
+    
     //
-    // Exit the tempo counting state without making any changes, discarding any
-    // tempo count.
+    // Handle the oldest edge let through by the capture interrupt handler (see
+    // QueueSyncEdge()), and leave any others for the next run.
     //
     
-    g_state.is_counting_tempo = 0;
-    g_tempo_ms_count = 0;
+    if (g_sync_edge_queue_count == 0)
+    {
+        return TaskResultDone;
+    }
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        head = g_sync_edge_queue_head;
+        time = g_sync_edge_queue_time[head];
+        is_start_edge = (g_sync_edge_queue_is_start >> head) & 0x01;
+        
+        g_sync_edge_queue_head = (head + 1) & (SYNC_EDGE_QUEUE_SIZE - 1);
+        g_sync_edge_queue_count--;
+    }
+    
+    SyncCapturedEdge(is_start_edge, time);
+    
+    return (g_sync_edge_queue_count > 0) ? TaskResultYield : TaskResultDone;
 }
+#endif
 
 void ResetSignals()
 {
     ResetBaseTempo();
     
-    g_phase_accumulator = 0;
-    g_table_index = 0;
+    g_dds.lfo.channel.phase_accumulator = 0;
+    g_dds.lfo.channel.table_index = 0;
     
-    g_multiplier_alignment_index = 0;
+    g_dds.poly.channel.phase_accumulator = 0;
+    g_dds.poly.channel.table_index = 0;
+    
+    TempoResetAlignment(&g_alignment);
 }
 
 void SeedRandomNumberGenerator(uint32_t seed)
-{
-    srand(seed);
-}
-
-void UpdateRandomNumber()
 {
     //
-    // Generate a "random" number within the specified range.
+    // The xorshift generator locks up if it is ever all zeros.
     //
     
-    g_random_number = (rand() % WAVEFORM_RANDOM_STEP_COUNT) * WAVEFORM_STEP_SIZE;
+    g_dds.noise_register = (seed & 0xffff) | 0x0001;
 }
 
-void PlotWaveform()
+void UpdateRandomNumber()
 {
-    uint8_t previous_table_index = g_table_index;
-    
-    //
-    // Calculate the next waveform table index. The phase accumulator keeps
-    // track of the current offset within a single waveform, and the duty cycle
-    // is a fixed "step" that gets added each interrupt. The given frequency
-    // will have an impact on the size of the duty cycle, and we'll complete
-    // the full waveform slower or faster based on each of these steps.
-    //
-    
-    g_phase_accumulator += g_duty_cycle;
-    g_table_index = (g_phase_accumulator & 0xff000000) >> 24;
-    
-    //
-    // 20190605 - Added Depth feature, all waves are previously plotted on g_depth_table.
-    //
-    if (g_waveform == WaveformRandom){
-		//
-		// Use whatever is the current random number. Make sure to change
-		// this number each complete waveform cycle.
-		//
-		OCR0A = g_depth_table[g_random_number];
-	} else {
-		OCR0A = g_depth_table[g_table_index];
-	}
-    
-    //
-    // If applicable, toggle the actual tempo indicator. 
-    //
-    
-    if (previous_table_index > g_table_index)
-    {
-        PORTA ^= (1 << TEMPO_OUT);
-        
-        //
-        // Update the random number for the random waveform.
-        //
-        
-        UpdateRandomNumber();
-    }
+    SyncDds();
+    StepRandomNumber(&g_dds);
 }
 
 void AlignWaveform()
 {
-    //
-    // Before proceeding, make sure the index isn't out of bounds.
-    //
+    uint8_t is_aligned;
     
-    if (g_multiplier_alignment_index >= MULTIPLIER_ALIGNMENT_OFFSET)
-    {
-        g_multiplier_alignment_index = 0;
-    }
+    SyncDds();
     
     //
     // Align the phase accumulator appropriately based on the waveform
     // multiplier. Each multiplier aligns with the base tempo at different
-    // intervals.
+    // intervals (see TempoStepAlignment()).
     //
     
-    if ((g_multiplier_alignment_index % k_multiplier_alignment[g_multiplier]) == 0)
+    is_aligned = TempoStepAlignment(&g_alignment);
+    
+    if (is_aligned & (1 << ALIGNMENT_LFO))
     {
-        g_phase_accumulator = 0;
+        g_dds.lfo.channel.phase_accumulator = 0;
     }
     
-    g_multiplier_alignment_index++;
+    if (is_aligned & (1 << ALIGNMENT_POLY))
+    {
+        g_dds.poly.channel.phase_accumulator = 0;
+    }
 }
 
 void AdjustSpeed(int16_t change_value)
@@ -361,14 +676,19 @@ void AdjustSpeed(int16_t change_value)
     //
     // Make sure the result doesn't exceed either upper or lower LFO limits.
     //
+    // Worked out in 32 bits; the sum of an unsigned base tempo and two signed
+    // offsets doesn't reliably fit (or promote sensibly) in 16.
+    //
     
-    int16_t new_tempo_count = g_base_tempo + g_tempo_adjust_offset + change_value;
-    
-    if ((new_tempo_count > LFO_MIN_TEMPO) || (new_tempo_count < LFO_MAX_TEMPO))
+    if (!TempoIsWithinLimits((int32_t)g_base_tempo + g_tempo_adjust_offset + change_value, LFO_MAX_TEMPO, LFO_MIN_TEMPO))
     {
         return;
     }
     
+#if SONG_MODE
+    StopSong();
+#endif
+    
     g_tempo_adjust_offset += change_value;
     RecalculateTempo();
 }
@@ -377,59 +697,27 @@ void ResetSpeedAdjustSetting()
 {
     g_tempo_adjust_offset = 0;
     RecalculateTempo();
+    
+#if SONG_MODE
+    RestartSong();
+#endif
 }
 
 void SetWaveform(int8_t change_value)
 {
-    //
-    // Change the current waveform to the next in line, either forward or back,
-    // making sure to wrap around when necessary.
-    //
-    
-    if ((g_waveform == WaveformSine) && (change_value < 0))
-    {
-        g_waveform = WaveformRandom;
-	}
-    else if ((g_waveform == WaveformRandom) && (change_value > 0))
-    {
-        g_waveform = WaveformSine;
-    }
-    else
-    {
-        g_waveform = g_waveform + change_value;
-    }
-	//20190605 - Since we change the WaveForm we need to update the depth table.
-	CalcDepthTable();
+    g_waveform = StepWaveform(g_waveform, change_value);
+    LoadWaveformRender(&g_dds.lfo.render, g_waveform);
 }
 
 void ResetWaveformSetting()
 {
     g_waveform = WaveformSine;
+    LoadWaveformRender(&g_dds.lfo.render, g_waveform);
 }
 
 void SetMultiplier(int8_t change_value)
 {
-    Multiplier multiplier;
-    
-    //
-    // Change the current multiplier to the next in line, either forward or
-    // back, stopping at either end (no wrap-around). This (and the ability to
-    // reset by depressing for 2 seconds) should make it relatively easier to
-    // set the desired multiplier without having a visual indicator.
-    //
-    
-    if ((g_multiplier == MultiplierWhole) && (change_value < 0))
-    {
-        multiplier = MultiplierWhole;
-    }
-    else if ((g_multiplier == MultiplierSixteenth) && (change_value > 0))
-    {
-        multiplier = MultiplierSixteenth;
-    }
-    else
-    {
-        multiplier = g_multiplier + change_value;
-    }
+    Multiplier multiplier = StepMultiplier(g_multiplier, change_value);
     
     //
     // Only change the multiplier if it's different.
@@ -439,8 +727,8 @@ void SetMultiplier(int8_t change_value)
     {
         g_multiplier = multiplier;
         
-        RecalculateTempo();
-        AdjustPhaseAccumulation();
+        LoadMultiplierRatio(ALIGNMENT_LFO, g_multiplier);
+        RecalculateRealignedTempo(REALIGN_LFO);
     }
 }
 
@@ -454,221 +742,1036 @@ void ResetMultiplierSetting()
     {
         g_multiplier = MultiplierQuarter;
         
-        RecalculateTempo();
-        AdjustPhaseAccumulation();
+        LoadMultiplierRatio(ALIGNMENT_LFO, g_multiplier);
+        RecalculateRealignedTempo(REALIGN_LFO);
     }
 }
 
-void SetDepth(int8_t change_value)
+void SetPolyWaveform(int8_t change_value)
 {
-	bool updateDepthTable = false;
-	if ((g_depth_ratio >= 5) && (g_depth_ratio <= 95))
-	{
-		g_depth_ratio = g_depth_ratio + change_value * 5;
-		updateDepthTable = true;
-	}
-	else if ((change_value > 0) && (g_depth_ratio == 0)) {
-		g_depth_ratio = g_depth_ratio + change_value * 5;
-		updateDepthTable = true;
-	}
-	else if ((change_value < 0) && (g_depth_ratio == 100)) {
-		g_depth_ratio = g_depth_ratio + change_value * 5;
-		updateDepthTable = true;
-	}
-	g_depth_offset = 255.0f * (100 - g_depth_ratio) / 100.0f;
-	if (updateDepthTable){
-		CalcDepthTable();
-	}
-
+    g_poly_waveform = StepWaveform(g_poly_waveform, change_value);
+    LoadWaveformRender(&g_dds.poly.render, g_poly_waveform);
 }
 
-void ResetDepthSetting()
+void ResetPolyWaveformSetting()
 {
-	g_depth_ratio = 100;
-	g_depth_offset = 0;
-	CalcDepthTable();
-}
-
-void CalcDepthTable() {
-	switch (g_waveform)
-	{
-		case WaveformSine:
-
-		//
-		// Drawing this one from a table. The given index holds the plot
-		// value.
-		// 20190506 - Due memory limitations we had to reduce the sin table to 64 bytes.
-		//
-
-		for (int16_t i = 0; i < WAVEFORM_RESOLUTION / 4; i++) {
-			g_depth_table[i] = CalcSignalDepth(k_sine_table[i]);
-			g_depth_table[255 - i] = g_depth_table[i];
-			g_depth_table[127 - i] = CalcSignalDepth(255 - k_sine_table[i]);
-			g_depth_table[128 + i] = g_depth_table[127 - i];
-		}
-
-		break;
-
-		case WaveformRampUp:
-		case WaveformRandom:
-		//For random Waveform we can use the same as RampUp.
-
-		//
-		//   /|  /|
-		//  / | / |
-		// /  |/  |
-		//
-		// Easily calculated; x = i
-		//
-
-		for (int16_t i = 0; i < WAVEFORM_RESOLUTION; i++) {
-			g_depth_table[i] = CalcSignalDepth(i);
-		}
-		break;
-
-		case WaveformRampDown:
-
-		//
-		// \  |\  |
-		//  \ | \ |
-		//   \|  \|
-		//
-		// Easily calculated; x = max - i
-		//
-		for (int16_t i = 0; i < WAVEFORM_RESOLUTION; i++) {
-			g_depth_table[i] = CalcSignalDepth(0xff - i);
-		}
-		break;
-
-		case WaveformTriangle:
-
-		//
-		// \    /\    /
-		//  \  /  \  /
-		//   \/    \/
-		//
-		// Easily calculated; first half: x = 2i then mirror the second half.
-		//
-		for (int16_t i = 0; i < WAVEFORM_RESOLUTION / 2; i++) {
-			g_depth_table[i] = CalcSignalDepth(i * 2);
-			g_depth_table[255 - i] = g_depth_table[i];
-		}
-		break;
-
-		case WaveformSquare:
-
-		//
-		// +-----+     |
-		// |     |     |
-		// |     +-----+
-		//
-		// Easily calculated; first half: x = min, second half: x = max
-		//
-		g_depth_table[0] = CalcSignalDepth(0x00);
-		
-		for (int16_t i = 1; i < WAVEFORM_RESOLUTION; i++) {
-			if (i < 0x80) {
-				g_depth_table[i] = g_depth_table[0];
-			}
-			else {
-				g_depth_table[i] = 0xff;
-			}
-		}
-		break;
-		case WaveformQuadPulse:
-		//
-		// +-+ +-+ +-+ +-+			   |
-		// | | | | | | | |			   |
-		// | | | | | | | |			   |
-		// | | | | | | | |			   |
-		// | +-+ +-+ +-+ +-------------+
-		//
-		g_depth_table[0xff] = CalcSignalDepth(0x00);
-		for (int16_t i = 0; i < WAVEFORM_RESOLUTION; i++) {
-			if (((i>=0x00) && (i<0x10)) || ((i >= 0x20) && (i < 0x30)) || ((i >= 0x40) && (i < 0x50)) || ((i >= 0x60) && (i < 0x70))) {
-				g_depth_table[i] = 0xff;
-			}
-			else {
-				g_depth_table[i] = g_depth_table[0xff];
-			}
-		}
-		break;
-		default:
-		break;
-	}
+    g_poly_waveform = WaveformSine;
+    LoadWaveformRender(&g_dds.poly.render, g_poly_waveform);
 }
 
-
-/*====== Local functions ====================================================== 
-=============================================================================*/
-
-void ResetBaseTempo()
+void SetPolyMultiplier(int8_t change_value)
 {
-    //
-    // Reset phase accumulator and wave table index for the base tempo.
-    //
+    Multiplier multiplier = StepMultiplier(g_poly_multiplier, change_value);
     
-    g_base_table_index = 0;
-    g_base_phase_accumulator = 0;
+    if (multiplier != g_poly_multiplier)
+    {
+        g_poly_multiplier = multiplier;
+        
+        LoadMultiplierRatio(ALIGNMENT_POLY, g_poly_multiplier);
+        RecalculateRealignedTempo(REALIGN_POLY);
+    }
 }
 
-void RecalculateTempo()
+void ResetPolyMultiplierSetting()
 {
-    float new_frequency;
+    if (g_poly_multiplier != MultiplierQuarter)
+    {
+        g_poly_multiplier = MultiplierQuarter;
+        
+        LoadMultiplierRatio(ALIGNMENT_POLY, g_poly_multiplier);
+        RecalculateRealignedTempo(REALIGN_POLY);
+    }
+}
 
-    //
-    // Convert the new tempo from a millisecond count to a frequency.
-    //
-    
-    new_frequency = (TEMPO_TO_FREQUENCY / (float)(g_base_tempo + g_tempo_adjust_offset));
+void SetRatioNumerator(int8_t change_value)
+{
+    uint8_t numerator = g_alignment.output[ALIGNMENT_LFO].numerator + change_value;
     
     //
-    // Recalculate the base duty cycle based on the new frequency.
+    // Change the number of output cycles per ratio period, stopping at either
+    // end (no wrap-around).
     //
     
-    g_base_duty_cycle = new_frequency * DUTY_CYCLE_DIVISOR;
+    if ((numerator >= 1) && (numerator <= RATIO_MAX))
+    {
+        TempoSetRatio(&g_alignment, ALIGNMENT_LFO, numerator, g_alignment.output[ALIGNMENT_LFO].denominator);
+        RecalculateRealignedTempo(REALIGN_LFO);
+    }
+}
+
+void SetRatioDenominator(int8_t change_value)
+{
+    uint8_t denominator = g_alignment.output[ALIGNMENT_LFO].denominator + change_value;
     
     //
-    // Use the base duty cycle and the current multiplier to calculate the
-    // working duty cycle.
+    // Change the number of base tempo cycles per ratio period, stopping at
+    // either end (no wrap-around).
     //
     
-    g_duty_cycle = g_base_duty_cycle * k_multiplier_ratio[g_multiplier];
+    if ((denominator >= 1) && (denominator <= RATIO_MAX))
+    {
+        TempoSetRatio(&g_alignment, ALIGNMENT_LFO, g_alignment.output[ALIGNMENT_LFO].numerator, denominator);
+        RecalculateRealignedTempo(REALIGN_LFO);
+    }
 }
 
-void AdjustPhaseAccumulation()
+void ResetRatioSetting()
 {
     //
-    // When the tempo multiplier has changed, the working phase accumulator
-    // also have to change to reflect how far the new duty cycle would have
-    // got had it been running from the start.
-    //
-    // By doing this the current tempo with multiplier will keep in sync with
-    // the base tempo.
+    // Go back to the ratio of the selected multiplier preset.
     //
-    // Note: For multipliers faster than 1:1 tempo the 32-bit working phase
-    //       accumulator will overflow and wrap around before the base one has
-    //       had a chance to do so. Fortunately, multiplying by the ratio to
-    //       get the new phase accumulator also overflows at 32 bits and the
-    //       end result is the same (at least it seems to work that way when
-    //       testing).
+    
+    LoadMultiplierRatio(ALIGNMENT_LFO, g_multiplier);
+    RecalculateRealignedTempo(REALIGN_LFO);
+}
+
+void SetSyncBarLength(int8_t change_value)
+{
+    uint8_t bar_length = g_sync_bar_length + change_value;
+    
     //
-    // Note 2: Because not all multipliers produce waveforms that align on
-    //         every base cycle, the multiplier alignment index also has to be
-    //         taken into account when finding the correct phase accumulator.
-    //         See AlignWaveform() for more details on this.
+    // Change the number of sync beats per bar, stopping at either end (no
+    // wrap-around). Stay within the new bar if already past its end.
     //
     
-    g_phase_accumulator = g_base_phase_accumulator * (k_multiplier_ratio[g_multiplier] * g_multiplier_alignment_index);
+    if ((bar_length >= 1) && (bar_length <= SYNC_BAR_LENGTH_MAX))
+    {
+        g_sync_bar_length = bar_length;
+        
+        if (g_sync_beat_index >= g_sync_bar_length)
+        {
+            g_sync_beat_index = 0;
+        }
+    }
 }
 
-uint8_t CalcSignalDepth(uint8_t value) {
-	//Only Calc Depth if enabled.
-	if (g_depth_ratio == 100) {
-		return value;
-	}
-	else {
-		return g_depth_offset + ((value)* g_depth_ratio) / 100.0f;
-	}
-}
-
+void SetDepth(int8_t change_value)
+{
+	bool updateDepthScale = false;
+	
+	SyncDds();
+	
+	if ((g_dds.depth_ratio >= 5) && (g_dds.depth_ratio <= 95))
+	{
+		g_dds.depth_ratio = g_dds.depth_ratio + change_value * 5;
+		updateDepthScale = true;
+	}
+	else if ((change_value > 0) && (g_dds.depth_ratio == 0)) {
+		g_dds.depth_ratio = g_dds.depth_ratio + change_value * 5;
+		updateDepthScale = true;
+	}
+	else if ((change_value < 0) && (g_dds.depth_ratio == 100)) {
+		g_dds.depth_ratio = g_dds.depth_ratio + change_value * 5;
+		updateDepthScale = true;
+	}
+	if (updateDepthScale){
+		CalcDepthScale();
+	}
+
+}
+
+void ResetDepthSetting()
+{
+	SyncDds();
+	g_dds.depth_ratio = 100;
+	CalcDepthScale();
+}
+
+void CalcDepthScale()
+{
+    //
+    // The depth is applied to each point as it is plotted:
+    //
+    //   x' = offset + (x * scale) / 256
+    //
+    // The scale is the depth ratio as an 8-bit fraction, and the offset makes
+    // sure the top of the waveform stays at max while the bottom is raised.
+    // At 100% depth the waveform is plotted as is.
+    //
+    
+    SyncDds();
+    
+    if (g_dds.depth_ratio >= 100)
+    {
+        g_dds.depth_scale = 0xff;
+        g_dds.depth_offset = 0;
+    }
+    else
+    {
+        g_dds.depth_scale = (((uint16_t)g_dds.depth_ratio * 256) + 50) / 100;
+        g_dds.depth_offset = 0xff - ScaleDepth(0xff, g_dds.depth_scale);
+    }
+}
+
+TaskResult RecalculateTempoTask()
+{
+    uint16_t tempo;
+    uint8_t numerator;
+    uint8_t denominator;
+    uint8_t poly_numerator;
+    uint8_t poly_denominator;
+    uint32_t base_duty_cycle;
+    uint32_t duty_cycle;
+    uint32_t poly_duty_cycle;
+#if SONG_MODE
+    uint32_t song_duty_cycle = 0;
+#endif
+#if SYNC_CAPTURE
+    int16_t tempo_adjust_offset;
+    uint32_t tempo_ticks;
+#endif
+    
+    //
+    // Take a snapshot of the settings, as the encoder can change them at any
+    // time. If it does so while the duty cycles are being worked out, the
+    // task is just scheduled again.
+    //
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        tempo = g_base_tempo + g_tempo_adjust_offset;
+#if SYNC_CAPTURE
+        tempo_adjust_offset = g_tempo_adjust_offset;
+        tempo_ticks = g_base_tempo_ticks;
+#endif
+        numerator = g_alignment.output[ALIGNMENT_LFO].numerator;
+        denominator = g_alignment.output[ALIGNMENT_LFO].denominator;
+        poly_numerator = g_alignment.output[ALIGNMENT_POLY].numerator;
+        poly_denominator = g_alignment.output[ALIGNMENT_POLY].denominator;
+        
+#if SONG_MODE
+        if (IsSongPlaying())
+        {
+            song_duty_cycle = g_dds.base.duty_cycle;
+        }
+#endif
+    }
+    
+#if SYNC_CAPTURE
+    //
+    // A captured sync period only comes in Timer1 counts (see
+    // SetCapturedTempo()); work out the millisecond base tempo from it here.
+    // Unless another period has been captured in the meantime, which has
+    // scheduled the task again.
+    //
+    
+    if (tempo_ticks != 0)
+    {
+        uint16_t milliseconds = (tempo_ticks + (TIMER1_TICKS_PER_MS / 2)) / TIMER1_TICKS_PER_MS;
+        
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            if (g_base_tempo_ticks == tempo_ticks)
+            {
+                g_base_tempo = milliseconds;
+            }
+        }
+        
+        tempo = milliseconds + tempo_adjust_offset;
+    }
+#endif
+    
+#if SONG_MODE
+    //
+    // While a song plays, the base duty cycle is whatever its current entry
+    // set, and only the outputs need redoing; along with the entry staged
+    // next, which was worked out with the old multipliers.
+    //
+    
+    if (song_duty_cycle != 0)
+    {
+        base_duty_cycle = song_duty_cycle;
+        ScheduleTask(TaskSongPrefetch);
+    }
+    else
+#endif
+#if SYNC_CAPTURE && !BPM_QUANTIZE
+    //
+    // A captured sync period gives the duty cycle to within a Timer1 count,
+    // rather than a millisecond. Quantizing to BPM works from the rounded
+    // milliseconds instead.
+    //
+    
+    if ((tempo_ticks != 0) && (tempo_adjust_offset == 0))
+    {
+        base_duty_cycle = CalcCapturedDutyCycle(tempo_ticks);
+    }
+    else
+#endif
+    {
+        base_duty_cycle = CalcBaseDutyCycle(tempo);
+    }
+    
+    //
+    // Use the base duty cycle and the current multiplier to calculate the
+    // working duty cycle.
+    //
+    
+    duty_cycle = (base_duty_cycle * numerator) / denominator;
+    poly_duty_cycle = (base_duty_cycle * poly_numerator) / poly_denominator;
+    
+    //
+    // Only the 32-bit stores need to be atomic, so the Timer0 handler never
+    // sees a half updated duty cycle. Any output whose ratio changed has its
+    // phase worked out for the new one in the same go (see
+    // RecalculateRealignedTempo()).
+    //
+    // If a ratio has changed again since the snapshot, the duty cycles worked
+    // out here are already stale. The setter has scheduled the task again, so
+    // the outputs keep their current duty cycle and phase until then.
+    //
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+#if SONG_MODE
+        //
+        // A song may have started, stopped or stepped to its next entry since
+        // the snapshot. Each of those sets its own duty cycles, so leave them
+        // be and start over from the new state.
+        //
+        
+        if (IsSongPlaying() ? (g_dds.base.duty_cycle != song_duty_cycle) : (song_duty_cycle != 0))
+        {
+            ScheduleTask(TaskRecalculateTempo);
+        }
+        else
+#endif
+        if ((g_alignment.output[ALIGNMENT_LFO].numerator == numerator) && (g_alignment.output[ALIGNMENT_LFO].denominator == denominator) &&
+            (g_alignment.output[ALIGNMENT_POLY].numerator == poly_numerator) && (g_alignment.output[ALIGNMENT_POLY].denominator == poly_denominator))
+        {
+            SetDutyCycles(base_duty_cycle, duty_cycle, poly_duty_cycle);
+            
+            if (g_realign_pending & REALIGN_LFO)
+            {
+                AdjustPhaseAccumulation();
+            }
+            
+            if (g_realign_pending & REALIGN_POLY)
+            {
+                AdjustPolyPhaseAccumulation();
+            }
+            
+            g_realign_pending = 0;
+        }
+    }
+    
+    return TaskResultDone;
+}
+
+void CalcOutputDutyCycles(uint32_t base_duty_cycle, uint32_t *duty_cycle, uint32_t *poly_duty_cycle)
+{
+    uint8_t numerator;
+    uint8_t denominator;
+    uint8_t poly_numerator;
+    uint8_t poly_denominator;
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        numerator = g_alignment.output[ALIGNMENT_LFO].numerator;
+        denominator = g_alignment.output[ALIGNMENT_LFO].denominator;
+        poly_numerator = g_alignment.output[ALIGNMENT_POLY].numerator;
+        poly_denominator = g_alignment.output[ALIGNMENT_POLY].denominator;
+    }
+    
+    *duty_cycle = (base_duty_cycle * numerator) / denominator;
+    *poly_duty_cycle = (base_duty_cycle * poly_numerator) / poly_denominator;
+}
+
+uint16_t CalcDutyCycleTempo(uint32_t base_duty_cycle)
+{
+    uint32_t tempo = LFO_MIN_TEMPO;
+    
+    //
+    // CalcBaseDutyCycle() the other way round; the tempo in milliseconds for a
+    // base duty cycle, rounded to the nearest, and kept within the LFO limits.
+    //
+    
+    if (base_duty_cycle != 0)
+    {
+        tempo = (DUTY_CYCLE_DIVIDEND + (base_duty_cycle / 2)) / base_duty_cycle;
+    }
+    
+    if (tempo > LFO_MIN_TEMPO)
+    {
+        tempo = LFO_MIN_TEMPO;
+    }
+    else if (tempo < LFO_MAX_TEMPO)
+    {
+        tempo = LFO_MAX_TEMPO;
+    }
+    
+    return tempo;
+}
+
+void SetDutyCycles(uint32_t base_duty_cycle, uint32_t duty_cycle, uint32_t poly_duty_cycle)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        SyncDds();
+        
+        g_dds.base.duty_cycle = base_duty_cycle;
+        g_dds.lfo.channel.duty_cycle = duty_cycle;
+        g_dds.poly.channel.duty_cycle = poly_duty_cycle;
+    }
+}
+
+//
+// Timer0 overflow interrupt handler. This is where the LFO signal is
+// generated.
+// Frequency: 31.25kHz (78.125kHz at 20MHz)
+//
+// Note: Lives here rather than in main.c so the whole handler can be inlined
+//       into a single function, without any calls.
+//
+// Note 2: With EVENT_DRIVEN_DDS the vector itself is just a countdown, and
+//         only jumps to the sample update once the countdown runs out. Every
+//         other overflow costs around 20 cycles including entry and exit.
+//
+
+#if EVENT_DRIVEN_DDS
+ISR(TIM0_OVF_vect, ISR_NAKED)
+{
+    __asm__ __volatile__ (
+        "push r24"                      "\n\t"
+        "in r24, __SREG__"              "\n\t"
+        "push r24"                      "\n\t"
+        "lds r24, g_dds_skip_count"     "\n\t"
+        "dec r24"                       "\n\t"
+        "sts g_dds_skip_count, r24"     "\n\t"
+        "breq 1f"                       "\n\t"
+        "pop r24"                       "\n\t"
+        "out __SREG__, r24"             "\n\t"
+        "pop r24"                       "\n\t"
+        "reti"                          "\n"
+        "1:"                            "\n\t"
+        "pop r24"                       "\n\t"
+        "out __SREG__, r24"             "\n\t"
+        "pop r24"                       "\n\t"
+        "rjmp __vector_dds_sample"      "\n\t"
+    );
+}
+
+ISR(TIM0_OVF_SAMPLE_vect)
+#else
+ISR(TIM0_OVF_vect)
+#endif
+{
+    volatile DdsState *dds = LoadDdsPointer();
+#if SONG_MODE
+    uint8_t previous_base_table_index = dds->base.table_index;
+#endif
+    
+    //
+    // Increase the phase accumulator by a given amount based on the required
+    // output signal frequency. Then use the high 8 bits (0-255) of the phase
+    // accumulator to identify what part of the wave to plot.
+    //
+    // We need both the base tempo (for the LED and sync output signal), and
+    // the actual LFO signal with applied tempo multiplier.
+    //
+    // Also see PlotWaveform().
+    //
+    
+    dds->base.phase_accumulator += DDS_STEP(dds->base.duty_cycle);
+    dds->base.table_index = (dds->base.phase_accumulator & 0xff000000) >> 24;
+    
+#if SONG_MODE
+    //
+    // Step the song on every beat, and have the next entry take over right on
+    // the sample where it's due.
+    //
+    
+    if ((dds->base.table_index < previous_base_table_index) && StepSongBeat())
+    {
+        dds->base.duty_cycle = g_song.next.base_duty_cycle;
+        dds->lfo.channel.duty_cycle = g_song.next.duty_cycle;
+        dds->poly.channel.duty_cycle = g_song.next.poly_duty_cycle;
+        
+        TakeSongStep();
+    }
+#endif
+    
+    //
+    // Draw the next point on the waveform.
+    //
+    
+    PlotWaveform(dds);
+    
+#if EVENT_DRIVEN_DDS
+    ScheduleNextSample(dds);
+#endif
+    
+    RecordSampleTime();
+}
+
+/*====== Local functions ====================================================== 
+=============================================================================*/
+
+void BeginTempoCount()
+{
+#if SONG_MODE
+    //
+    // Tapping or syncing takes tempo control back from a playing song.
+    //
+    
+    if (IsSongPlaying())
+    {
+        StopSong();
+        RecalculateTempo();
+    }
+#endif
+    
+    g_tempo_ms_count = 0;
+    g_state.is_counting_tempo = 1;
+}
+
+void EndTempoCount()
+{
+    if (g_state.is_counting_tempo == 1)
+    {
+        g_state.is_counting_tempo = 0;
+        
+        SetBaseTempo(g_tempo_ms_count);
+        g_tempo_ms_count = 0;
+    }
+}
+
+void ResetBaseTempo()
+{
+    //
+    // Reset phase accumulator and wave table index for the base tempo.
+    //
+    
+    SyncDds();
+    
+    g_dds.base.table_index = 0;
+    g_dds.base.phase_accumulator = 0;
+}
+
+void RecalculateTempo()
+{
+    //
+    // The divisions involved are too slow to do with interrupts disabled (or
+    // from inside one), so leave them to the main loop. See
+    // RecalculateTempoTask().
+    //
+    
+    ScheduleTask(TaskRecalculateTempo);
+}
+
+void RecalculateRealignedTempo(uint8_t outputs)
+{
+    //
+    // A new ratio needs the output's phase worked out again as well (see
+    // TempoCalcPhase()), but that phase only holds for the new duty
+    // cycle. Both are switched over together in RecalculateTempoTask(), so the
+    // output never runs the old duty cycle from the new phase.
+    //
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        g_realign_pending |= outputs;
+    }
+    
+    RecalculateTempo();
+}
+
+#if SYNC_CAPTURE
+void SyncCapturedEdge(uint8_t is_start_edge, uint32_t time)
+{
+    uint32_t late_ticks;
+    
+    //
+    // Same as an edge in the pin change interrupt handler, only later, so the
+    // state shared with the interrupt handlers is changed with interrupts
+    // disabled throughout, as it was there.
+    //
+    // The period is measured from the start edge to the stop edge, and handed
+    // over before SyncTempoEdge() gets to the (coarser) millisecond tempo
+    // count, which is then discarded. That count still runs for the timeout.
+    //
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (is_start_edge)
+        {
+            g_sync_capture_start_time = time;
+        }
+        else if (g_state.is_counting_tempo == 1)
+        {
+            g_state.is_counting_tempo = 0;
+            g_tempo_ms_count = 0;
+            
+            SetCapturedTempo(time - g_sync_capture_start_time);
+        }
+        
+        //
+        // The base tempo has moved on by a sample's duty cycle for every
+        // SYNC_CAPTURE_SCALE Timer1 counts since the edge.
+        //
+        
+        late_ticks = ReadSyncCaptureTime() - time;
+        
+        SyncTempoEdge(is_start_edge, g_dds.base.duty_cycle * (late_ticks / SYNC_CAPTURE_SCALE));
+    }
+}
+
+uint32_t ReadSyncCaptureTime()
+{
+    uint16_t ticks = TCNT1;
+    
+    //
+    // Timer1 counts since start up, as for a captured edge. Interrupts have to
+    // be disabled; a wrap that the compare interrupt hasn't counted yet is
+    // added here.
+    //
+    
+    if ((TIFR1 & (1 << OCF1A)) && (ticks < (TIMER1_TICKS_PER_MS / 2)))
+    {
+        ticks += TIMER1_TICKS_PER_MS;
+    }
+    
+    return g_sync_capture_time + ticks;
+}
+
+void SetCapturedTempo(uint32_t ticks)
+{
+    uint32_t tick_difference;
+    
+    //
+    // Same limits as SetBaseTempo(), to the nearest millisecond (see
+    // SYNC_CAPTURE_MIN_TICKS).
+    //
+    
+    if ((ticks > SYNC_CAPTURE_MAX_TICKS) || (ticks < SYNC_CAPTURE_MIN_TICKS))
+    {
+        return;
+    }
+    
+    tick_difference = (g_base_tempo_ticks > ticks) ?
+        (g_base_tempo_ticks - ticks) : (ticks - g_base_tempo_ticks);
+    
+    if (tick_difference > SYNC_CAPTURE_TOLERANCE)
+    {
+        //
+        // Called with interrupts disabled, so only the counts are stored here.
+        // RecalculateTempoTask() works out the millisecond tempo kept
+        // alongside, for everything that counts in milliseconds (speed
+        // adjustment, the tap tempo comparison).
+        //
+        
+        g_base_tempo_ticks = ticks;
+        g_tempo_adjust_offset = 0;
+        
+        RecalculateTempo();
+    }
+}
+
+uint32_t CalcCapturedDutyCycle(uint32_t ticks)
+{
+    //
+    // 2^32 * SYNC_CAPTURE_SCALE / ticks, rounded to the nearest step. 2^32 is
+    // divided first, and the scaled remainder after; both stay within 32
+    // bits, since ticks are below 2^32 / SYNC_CAPTURE_SCALE over the whole
+    // LFO range.
+    //
+    
+    uint32_t whole = 0xffffffffUL / ticks;
+    uint32_t remainder = (0xffffffffUL % ticks) + 1;
+    
+    if (remainder >= ticks)
+    {
+        whole++;
+        remainder -= ticks;
+    }
+    
+    return (whole * SYNC_CAPTURE_SCALE) + (((remainder * SYNC_CAPTURE_SCALE) + (ticks / 2)) / ticks);
+}
+#endif
+
+uint32_t CalcBaseDutyCycle(uint16_t tempo)
+{
+#if BPM_QUANTIZE
+    return TempoCalcQuantizedDutyCycle(BPM_QUANTIZE_DIVIDEND, BPM_STEP_DUTY_CYCLE, tempo);
+#else
+    return TempoCalcDutyCycle(DUTY_CYCLE_DIVIDEND, tempo);
+#endif
+}
+
+void AdjustPhaseAccumulation()
+{
+    SyncDds();
+    g_dds.lfo.channel.phase_accumulator = TempoCalcPhase(&g_alignment, ALIGNMENT_LFO, g_dds.base.phase_accumulator);
+}
+
+void AdjustPolyPhaseAccumulation()
+{
+    SyncDds();
+    g_dds.poly.channel.phase_accumulator = TempoCalcPhase(&g_alignment, ALIGNMENT_POLY, g_dds.base.phase_accumulator);
+}
+
+void LoadMultiplierRatio(uint8_t output, Multiplier multiplier)
+{
+    TempoSetRatio(&g_alignment, output, pgm_read_byte(&k_multiplier_ratio[multiplier].numerator), pgm_read_byte(&k_multiplier_ratio[multiplier].denominator));
+}
+
+Waveform StepWaveform(Waveform waveform, int8_t change_value)
+{
+    //
+    // Change the waveform to the next in line, either forward or back,
+    // making sure to wrap around when necessary.
+    //
+    
+    if ((waveform == WaveformSine) && (change_value < 0))
+    {
+        return WaveformCount - 1;
+    }
+    else if ((waveform == (WaveformCount - 1)) && (change_value > 0))
+    {
+        return WaveformSine;
+    }
+    
+    return waveform + change_value;
+}
+
+Multiplier StepMultiplier(Multiplier multiplier, int8_t change_value)
+{
+    //
+    // Change the multiplier to the next in line, either forward or back,
+    // stopping at either end (no wrap-around). This (and the ability to reset
+    // by depressing for 2 seconds) should make it relatively easier to set the
+    // desired multiplier without having a visual indicator.
+    //
+    
+    if ((multiplier == MultiplierWhole) && (change_value < 0))
+    {
+        return MultiplierWhole;
+    }
+    else if ((multiplier == MultiplierSixteenth) && (change_value > 0))
+    {
+        return MultiplierSixteenth;
+    }
+    
+    return multiplier + change_value;
+}
+
+void LoadWaveformRender(volatile WaveformRender *render, Waveform waveform)
+{
+    //
+    // Keep a RAM copy of the waveform's render descriptor so the timer
+    // interrupt doesn't have to go through program memory.
+    //
+    
+    SyncDds();
+    
+    render->mode = pgm_read_byte(&k_waveform_render[waveform].mode);
+    render->mask = pgm_read_byte(&k_waveform_render[waveform].mask);
+    render->match = pgm_read_byte(&k_waveform_render[waveform].match);
+}
+
+void SyncDds()
+{
+#if EVENT_DRIVEN_DDS
+    uint8_t elapsed;
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        //
+        // Catch the phase accumulators up with the overflows that have been
+        // skipped since the last sample update, and make sure the very next
+        // overflow does a full update with whatever is about to change.
+        //
+        
+        elapsed = (1 << g_dds_skip_shift) - g_dds_skip_count;
+        
+        if (elapsed > 0)
+        {
+            g_dds.base.phase_accumulator += g_dds.base.duty_cycle * elapsed;
+            g_dds.lfo.channel.phase_accumulator += g_dds.lfo.channel.duty_cycle * elapsed;
+            g_dds.poly.channel.phase_accumulator += g_dds.poly.channel.duty_cycle * elapsed;
+        }
+        
+        g_dds_skip_shift = 0;
+        g_dds_skip_count = 1;
+    }
+#endif
+}
+
+ISR_INLINE volatile DdsState *LoadDdsPointer()
+{
+    volatile DdsState *dds = &g_dds;
+    
+    //
+    // Hide where the pointer points from the compiler, so it has to keep it in
+    // a base pointer register ("b"; Y or Z) and use displacement addressing,
+    // rather than folding it back into an absolute address for every access.
+    //
+    
+    __asm__ ("" : "+b" (dds));
+    
+    return dds;
+}
+
+ISR_INLINE void PlotWaveform(volatile DdsState *dds)
+{
+    uint8_t previous_table_index = dds->lfo.channel.table_index;
+    
+    //
+    // Calculate the next waveform table index. The phase accumulator keeps
+    // track of the current offset within a single waveform, and the duty cycle
+    // is a fixed "step" that gets added each interrupt. The given frequency
+    // will have an impact on the size of the duty cycle, and we'll complete
+    // the full waveform slower or faster based on each of these steps.
+    //
+    
+    dds->lfo.channel.phase_accumulator += DDS_STEP(dds->lfo.channel.duty_cycle);
+    dds->lfo.channel.table_index = (dds->lfo.channel.phase_accumulator & 0xff000000) >> 24;
+    
+    //
+    // Same for the polyrhythm output, using its own duty cycle.
+    //
+    
+    dds->poly.channel.phase_accumulator += DDS_STEP(dds->poly.channel.duty_cycle);
+    dds->poly.channel.table_index = (dds->poly.channel.phase_accumulator & 0xff000000) >> 24;
+    
+    //
+    // Now plot a single point on the selected waveform of each output.
+    //
+    
+    OCR0A = RenderWaveform(dds, &dds->lfo);
+    OCR0B = RenderWaveform(dds, &dds->poly);
+    
+    //
+    // If applicable, toggle the actual tempo indicator. 
+    //
+    
+    if (previous_table_index > dds->lfo.channel.table_index)
+    {
+        PORTA ^= (1 << TEMPO_OUT);
+        
+        //
+        // Update the random number for the random waveform. The polyrhythm
+        // output shares this number if it's also set to "random".
+        //
+        
+        StepRandomNumber(dds);
+    }
+}
+
+#if EVENT_DRIVEN_DDS
+ISR_INLINE void ScheduleNextSample(volatile DdsState *dds)
+{
+    uint32_t base_step = dds->base.duty_cycle;
+    uint32_t step = dds->lfo.channel.duty_cycle;
+    uint32_t poly_step = dds->poly.channel.duty_cycle;
+    uint32_t base_remaining;
+    uint32_t remaining;
+    uint32_t poly_remaining;
+    uint8_t shift = 0;
+    
+    //
+    // Work out how far each phase accumulator is from moving its table index
+    // (the low 24 bits wrapping around).
+    //
+    
+    base_remaining = 0x01000000 - (dds->base.phase_accumulator & 0x00ffffff);
+    remaining = 0x01000000 - (dds->lfo.channel.phase_accumulator & 0x00ffffff);
+    poly_remaining = 0x01000000 - (dds->poly.channel.phase_accumulator & 0x00ffffff);
+    
+    //
+    // Keep doubling the number of overflows to the next sample update for as
+    // long as none of the table indexes would move before it. The index may
+    // move on the update itself, as that one gets plotted.
+    //
+    // Note: Each step stays at or below 2^24 before doubling, so none of them
+    //       can overflow.
+    //
+    
+    while (shift < DDS_MAX_SKIP_SHIFT)
+    {
+        if (((base_step << 1) > base_remaining) || ((step << 1) > remaining) || ((poly_step << 1) > poly_remaining))
+        {
+            break;
+        }
+        
+        base_step <<= 1;
+        step <<= 1;
+        poly_step <<= 1;
+        shift++;
+    }
+    
+    g_dds_skip_shift = shift;
+    g_dds_skip_count = 1 << shift;
+}
+#endif
+
+ISR_INLINE uint8_t RenderWaveform(volatile DdsState *dds, volatile DdsOutput *output)
+{
+    volatile WaveformRender *render = &output->render;
+    volatile NoiseState *noise = &output->noise;
+    uint8_t index = output->channel.table_index;
+    uint8_t value;
+    
+    switch (render->mode)
+    {
+        case RenderRamp:
+        
+            //
+            //   /|  /|        \  |\  |
+            //  / | / |   or    \ | \ |
+            // /  |/  |          \|  \|
+            //
+            // x = i, or x = max - i when inverted by the mask.
+            //
+            
+            value = index ^ render->mask;
+            break;
+        
+        case RenderTriangle:
+        
+            //
+            // \    /\    /
+            //  \  /  \  /
+            //   \/    \/
+            //
+            // First half: x = 2i, second half: x = 2(max - i).
+            //
+            
+            if (index & 0x80)
+            {
+                index = ~index;
+            }
+            
+            value = index << 1;
+            break;
+        
+        case RenderPulse:
+        
+            //
+            // +-----+     |    +-+ +-+ +-+ +-+         |
+            // |     |     | or | | | | | | | |         |
+            // |     +-----+    | +-+ +-+ +-+ +---------+
+            //
+            // x = max when the masked index bits match, x = min otherwise.
+            //
+            
+            value = ((index & render->mask) == render->match) ? 0xff : 0x00;
+            break;
+        
+        case RenderSine:
+        
+            //
+            // The table holds the first quarter of the wave. The second and
+            // fourth quarters read it backwards, and the second and third
+            // quarters are flipped upside down.
+            //
+            
+            value = pgm_read_byte(&k_sine_table[(index & 0x40) ? (~index & 0x3f) : (index & 0x3f)]);
+            
+            if ((index ^ (index << 1)) & 0x80)
+            {
+                value = 0xff - value;
+            }
+            break;
+        
+        case RenderNoise:
+        
+            //
+            // Only do any work when the table index has moved on. Take a new
+            // random value when crossing a step boundary, and either jump
+            // straight to it or glide towards it when smoothed.
+            //
+            
+            if (index != noise->index)
+            {
+                if ((index ^ noise->index) & render->mask)
+                {
+                    noise->target = StepNoise(dds);
+                }
+                
+                noise->index = index;
+                
+                if (render->match)
+                {
+                    noise->level += ((int16_t)noise->target - noise->level) >> NOISE_SMOOTH_SHIFT;
+                }
+                else
+                {
+                    noise->level = noise->target;
+                }
+            }
+            
+            value = noise->level;
+            break;
+        
+        default:
+        
+            //
+            // Use whatever is the current random number. Make sure to change
+            // this number each complete waveform cycle.
+            //
+            
+            value = dds->random_number;
+            break;
+    }
+    
+    //
+    // Only apply depth if enabled.
+    //
+    
+    if (dds->depth_ratio != 100)
+    {
+        value = dds->depth_offset + ScaleDepth(value, dds->depth_scale);
+    }
+    
+    return value;
+}
+
+ISR_INLINE void StepRandomNumber(volatile DdsState *dds)
+{
+    //
+    // Generate a "random" number within the specified range.
+    //
+    
+    dds->random_number = StepNoise(dds) & WAVEFORM_RANDOM_MASK;
+}
+
+ISR_INLINE uint8_t StepNoise(volatile DdsState *dds)
+{
+    uint16_t noise = dds->noise_register;
+    
+    //
+    // xorshift step; the 8-bit shift is a plain byte move on the AVR.
+    //
+    
+    noise ^= noise << 7;
+    noise ^= noise >> 9;
+    noise ^= noise << 8;
+    
+    dds->noise_register = noise;
+    
+    return noise >> 8;
+}
+
+ISR_INLINE uint8_t ScaleDepth(uint8_t value, uint8_t scale)
+{
+    uint16_t result = 0;
+    uint8_t bit;
+    
+    //
+    // (value * scale) / 256 as a plain shift-add, since the attiny has no
+    // hardware multiplier.
+    //
+    
+    for (bit = 0x80; bit != 0; bit >>= 1)
+    {
+        result <<= 1;
+        
+        if (scale & bit)
+        {
+            result += value;
+        }
+    }
+    
+    return result >> 8;
+}
@@ -25,6 +25,10 @@
 #ifndef __SIGNALING_H__
 #define __SIGNALING_H__
 
+#include "main.h"
+#include "scheduler.h"
+#include "stats.h"
+
 //
 // Defines and structs.
 //
@@ -41,19 +45,57 @@
 
 #define LFO_MAX_TEMPO           		50
 
+//
+// Sync input glitch filter (see IsSyncEdgeGlitch()). Edges less than
+// SYNC_MIN_PULSE_WIDTH milliseconds (Makefile) after the previous one on the
+// pin are always dropped. Ones less than 1/2^SYNC_MIN_PERIOD_SHIFT of the
+// input's last period after the last edge let through going the same way are
+// dropped once. A period longer than SYNC_MAX_PERIOD is a pause in the input,
+// and leaves nothing to compare the next one with.
+//
+// The time between edges is in milliseconds, or with SYNC_CAPTURE in Timer1
+// counts from the captured edge times, so a glitch is told apart to within a
+// count rather than a whole millisecond. Either way the time since an edge is
+// counted up a millisecond at a time (see CountSyncEdgeTime()), and stops at
+// SYNC_TIME_MAX.
+//
+
+#ifndef SYNC_MIN_PULSE_WIDTH
+#define SYNC_MIN_PULSE_WIDTH            2
+#endif
+
+#define SYNC_MIN_PERIOD_SHIFT           2
+#define SYNC_MAX_PERIOD                 LFO_MIN_TEMPO
+
+#if SYNC_CAPTURE
+typedef uint32_t SyncTime;
+#define SYNC_TIME_PER_MS                ((uint32_t)TIMER1_TICKS_PER_MS)
+#else
+typedef uint16_t SyncTime;
+#define SYNC_TIME_PER_MS                1
+#endif
+
+#define SYNC_TIME_MAX                   (0xffff * SYNC_TIME_PER_MS)
+
 //
 // Public function prototypes.
 //
 
+void InitializeSignaling();
 void SetBaseTempo(uint16_t milliseconds);
+void CalcOutputDutyCycles(uint32_t base_duty_cycle, uint32_t *duty_cycle, uint32_t *poly_duty_cycle);
+uint16_t CalcDutyCycleTempo(uint32_t base_duty_cycle);
+void SetDutyCycles(uint32_t base_duty_cycle, uint32_t duty_cycle, uint32_t poly_duty_cycle);
 void StartTempoCount();
 void StopTempoCount();
-void TempoCountTimeout();
+void SyncTempoEdge(uint8_t is_start_edge, uint32_t base_phase);
+#if SYNC_CAPTURE
+TaskResult SyncEdgeTask();
+#endif
 void ResetSignals();
 
 void SeedRandomNumberGenerator(uint32_t seed);
 void UpdateRandomNumber();
-void PlotWaveform();
 void AlignWaveform();
 
 void AdjustSpeed(int16_t change_value);
@@ -64,9 +106,191 @@ void ResetWaveformSetting();
 
 void SetMultiplier(int8_t change_value);
 void ResetMultiplierSetting();
+void SetSyncBarLength(int8_t change_value);
+
+void SetRatioNumerator(int8_t change_value);
+void SetRatioDenominator(int8_t change_value);
+void ResetRatioSetting();
+
+void SetPolyWaveform(int8_t change_value);
+void ResetPolyWaveformSetting();
+
+void SetPolyMultiplier(int8_t change_value);
+void ResetPolyMultiplierSetting();
 
 void SetDepth(int8_t change_value);
 void ResetDepthSetting();
-void CalcDepthTable();
+void CalcDepthScale();
+
+TaskResult RecalculateTempoTask();
+
+//
+// Public inline functions. Called from the Timer1 interrupt handler.
+//
+
+extern volatile uint8_state_flags g_state;
+extern volatile uint16_t g_tempo_ms_count;
+
+extern volatile SyncTime g_sync_edge_time;
+extern volatile SyncTime g_sync_period_time[2];
+extern volatile SyncTime g_sync_period[2];
+extern volatile uint8_t g_has_rejected_sync_period[2];
+
+#if SYNC_CAPTURE
+//
+// Sync edges let through by the capture interrupt handler, waiting for
+// SyncEdgeTask(). Timed in Timer1 counts since start up (wraps after over 28
+// minutes at 20MHz; only differences are used).
+//
+
+#define SYNC_EDGE_QUEUE_SIZE            4
+
+extern volatile uint32_t g_sync_capture_time;
+extern volatile uint32_t g_sync_edge_queue_time[SYNC_EDGE_QUEUE_SIZE];
+extern volatile uint8_t g_sync_edge_queue_is_start;
+extern volatile uint8_t g_sync_edge_queue_head;
+extern volatile uint8_t g_sync_edge_queue_count;
+#endif
+
+ISR_INLINE void TempoCountTimeout()
+{
+    //
+    // Exit the tempo counting state without making any changes, discarding any
+    // tempo count.
+    //
+    
+    RecordTempoTimeout(g_state.is_sync_tempo);
+    
+    g_state.is_counting_tempo = 0;
+    g_tempo_ms_count = 0;
+}
+
+ISR_INLINE void CountSyncEdgeTime()
+{
+    //
+    // Time since the last edge on the sync input, and since the last stop (0)
+    // and start (1) edge let through, as of the last millisecond.
+    //
+    
+    if (g_sync_edge_time < SYNC_TIME_MAX)
+    {
+        g_sync_edge_time += SYNC_TIME_PER_MS;
+    }
+    
+    if (g_sync_period_time[0] < SYNC_TIME_MAX)
+    {
+        g_sync_period_time[0] += SYNC_TIME_PER_MS;
+    }
+    
+    if (g_sync_period_time[1] < SYNC_TIME_MAX)
+    {
+        g_sync_period_time[1] += SYNC_TIME_PER_MS;
+    }
+    
+#if SYNC_CAPTURE
+    g_sync_capture_time += TIMER1_TICKS_PER_MS;
+#endif
+}
+
+ISR_INLINE uint8_t IsSyncEdgeGlitch(uint8_t is_start_edge, uint8_t is_new_level, SyncTime elapsed, SyncTime period)
+{
+    uint8_t is_glitch = 0;
+    
+    //
+    // A noisy cable makes for extra edges, each of which would restart or end
+    // the tempo count. An edge too close to the previous one on the pin, let
+    // through or not, is noise whatever the input is doing.
+    //
+    // Otherwise the edge is timed from the last one let through going the
+    // same way; one period of the input, be it a square wave or short pulses,
+    // whatever the pulse width. A period well inside the previous one is taken
+    // as noise the first time, but if the next one is as well, the input
+    // really has sped up that much.
+    //
+    
+    g_sync_edge_time = 0;
+    
+    if (elapsed < (SYNC_MIN_PULSE_WIDTH * SYNC_TIME_PER_MS))
+    {
+        is_glitch = 1;
+    }
+    else if (period < (g_sync_period[is_start_edge] >> SYNC_MIN_PERIOD_SHIFT))
+    {
+        //
+        // An edge back to the level last let through (is_new_level == 0)
+        // ends a dropped glitch, or a pulse too short to count. It's only let
+        // through as a period in its own right, so it doesn't get the second
+        // chance.
+        //
+        
+        if (is_new_level == 0)
+        {
+            is_glitch = 1;
+        }
+        else if (g_has_rejected_sync_period[is_start_edge] == 0)
+        {
+            g_has_rejected_sync_period[is_start_edge] = 1;
+            is_glitch = 1;
+        }
+    }
+    
+    //
+    // Only the edges away from the level let through count in the field
+    // statistics; one per glitch, not the edge back as well.
+    //
+    
+    if (is_glitch)
+    {
+        if (is_new_level)
+        {
+            RecordSyncGlitch();
+        }
+        
+        return 1;
+    }
+    
+    g_sync_period_time[is_start_edge] = 0;
+    g_sync_period[is_start_edge] = (period < (SYNC_MAX_PERIOD * SYNC_TIME_PER_MS)) ? period : 0;
+    g_has_rejected_sync_period[is_start_edge] = 0;
+    
+    return 0;
+}
+
+#if SYNC_CAPTURE
+ISR_INLINE void QueueSyncEdge(uint8_t is_start_edge, uint32_t time)
+{
+    uint8_t tail;
+    
+    //
+    // Hand the edge over to SyncEdgeTask(), which does the tempo and alignment
+    // work that's too slow for the capture interrupt handler. Edges are at
+    // least SYNC_MIN_PULSE_WIDTH apart, so the queue only fills up if the main
+    // loop stalls; the newest edge is dropped then, rather than one that's
+    // half way through being handled.
+    //
+    
+    if (g_sync_edge_queue_count >= SYNC_EDGE_QUEUE_SIZE)
+    {
+        return;
+    }
+    
+    tail = (g_sync_edge_queue_head + g_sync_edge_queue_count) & (SYNC_EDGE_QUEUE_SIZE - 1);
+    
+    g_sync_edge_queue_time[tail] = time;
+    
+    if (is_start_edge)
+    {
+        g_sync_edge_queue_is_start |= (1 << tail);
+    }
+    else
+    {
+        g_sync_edge_queue_is_start &= ~(1 << tail);
+    }
+    
+    g_sync_edge_queue_count++;
+    
+    ScheduleTask(TaskSyncEdge);
+}
+#endif
 
 #endif // __SIGNALING_H__
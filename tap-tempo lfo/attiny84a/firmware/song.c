@@ -0,0 +1,214 @@
+//
+// Tap-tempo LFO for 8-bit AVR.
+// 
+// Copyright (C) 2013-2016 Harald Sabro
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Contact info
+// ------------
+// Website: sabrotone.com
+// Email: harald (AT) website 
+//
+
+
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <util/atomic.h>
+
+#include "main.h"
+#include "scheduler.h"
+#include "signaling.h"
+#include "song.h"
+
+#if SONG_MODE
+
+//
+// Local function prototypes.
+//
+
+void StartSong();
+uint8_t ReadSongHeader(SongHeader *header);
+void LoadSongStep(uint8_t index, uint8_t beats_per_bar, SongStep *step);
+
+//
+// Global variables.
+//
+
+volatile SongState g_song = { .next_index = SONG_END };
+
+/*====== Public functions ===================================================== 
+=============================================================================*/
+
+void RestartSong()
+{
+    g_song.is_starting = 1;
+    ScheduleTask(TaskSongPrefetch);
+}
+
+void StopSong()
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        g_song.is_playing = 0;
+        g_song.is_starting = 0;
+        g_song.beats_left = 0;
+        g_song.next.beats = 0;
+        g_song.next_index = SONG_END;
+    }
+}
+
+TaskResult SongPrefetchTask()
+{
+    uint8_t index;
+    uint8_t beats_per_bar;
+    SongStep step;
+    
+    //
+    // The map can't be read while the field statistics are being written to
+    // EEPROM; come back once the current byte is done.
+    //
+    
+    if (!eeprom_is_ready())
+    {
+        return TaskResultYield;
+    }
+    
+    if (g_song.is_starting)
+    {
+        StartSong();
+        
+        return TaskResultDone;
+    }
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        index = g_song.next_index;
+        beats_per_bar = g_song.beats_per_bar;
+    }
+    
+    if (index == SONG_END)
+    {
+        return TaskResultDone;
+    }
+    
+    LoadSongStep(index, beats_per_bar, &step);
+    
+    //
+    // Only stage it if the Timer0 handler hasn't moved on in the meantime (it
+    // has then scheduled this task again for the entry after).
+    //
+    // Note: Also run again when the multipliers change while a song plays, to
+    //       restage the entry with the new ratios.
+    //
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        if (g_song.next_index == index)
+        {
+            g_song.next = step;
+        }
+    }
+    
+    return TaskResultDone;
+}
+
+/*====== Local functions ====================================================== 
+=============================================================================*/
+
+void StartSong()
+{
+    SongHeader header;
+    SongStep step;
+    
+    g_song.is_starting = 0;
+    
+    if (!ReadSongHeader(&header))
+    {
+        return;
+    }
+    
+    LoadSongStep(0, header.beats_per_bar, &step);
+    
+    //
+    // Put the first entry straight on the outputs, and start the first bar
+    // from the top right now.
+    //
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        g_song.entry_count = header.entry_count;
+        g_song.beats_per_bar = header.beats_per_bar;
+        g_song.flags = header.flags;
+        g_song.next_index = 0;
+        g_song.next = step;
+        g_song.is_playing = 1;
+        
+        ResetSignals();
+        SetDutyCycles(step.base_duty_cycle, step.duty_cycle, step.poly_duty_cycle);
+        TakeSongStep();
+    }
+}
+
+uint8_t ReadSongHeader(SongHeader *header)
+{
+    uint16_t size;
+    uint16_t i;
+    uint8_t sum = 0;
+    
+    eeprom_read_block(header, (const void *)SONG_EEPROM_ADDRESS, sizeof(SongHeader));
+    
+    //
+    // Check that there is a map at all (erased EEPROM reads all 0xff), that it
+    // was made for this clock, since the duty cycles depend on the sample
+    // rate, and that it was written in full.
+    //
+    
+    if ((header->magic != SONG_MAGIC) ||
+        (header->clock_mhz != (CLOCK_FREQUENCY / 1000000UL)) ||
+        (header->entry_count == 0) ||
+        (header->entry_count > SONG_ENTRY_MAX) ||
+        (header->beats_per_bar == 0))
+    {
+        return 0;
+    }
+    
+    size = sizeof(SongHeader) + (header->entry_count * sizeof(SongEntry));
+    
+    for (i = 0; i < size; i++)
+    {
+        sum += eeprom_read_byte((const uint8_t *)(SONG_EEPROM_ADDRESS + i));
+    }
+    
+    return ((uint8_t)~sum == eeprom_read_byte((const uint8_t *)(SONG_EEPROM_ADDRESS + size)));
+}
+
+void LoadSongStep(uint8_t index, uint8_t beats_per_bar, SongStep *step)
+{
+    SongEntry entry;
+    
+    eeprom_read_block(&entry, (const void *)(SONG_EEPROM_ADDRESS + sizeof(SongHeader) + (index * sizeof(SongEntry))), sizeof(SongEntry));
+    
+    //
+    // The base duty cycle comes ready made; its tempo in milliseconds and the
+    // outputs (which depend on the multipliers currently set) don't.
+    //
+    
+    step->base_duty_cycle = entry.base_duty_cycle;
+    step->base_tempo = CalcDutyCycleTempo(entry.base_duty_cycle);
+    CalcOutputDutyCycles(entry.base_duty_cycle, &step->duty_cycle, &step->poly_duty_cycle);
+    step->beats = (uint16_t)((entry.bars != 0) ? entry.bars : 1) * beats_per_bar;
+}
+
+#endif // SONG_MODE
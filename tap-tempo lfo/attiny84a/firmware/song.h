@@ -0,0 +1,202 @@
+//
+// Tap-tempo LFO for 8-bit AVR.
+// 
+// Copyright (C) 2013-2016 Harald Sabro
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Contact info
+// ------------
+// Website: sabrotone.com
+// Email: harald (AT) website 
+//
+
+
+#ifndef __SONG_H__
+#define __SONG_H__
+
+#include <avr/io.h>
+
+#include "main.h"
+#include "scheduler.h"
+
+//
+// Song mode (SONG_MODE=1 in the Makefile). Plays back a tempo map stored in
+// EEPROM, e.g. 16 bars at 120 BPM, then 8 bars at 90 BPM; stepping through it
+// on the beat (base tempo cycle wrap) in the Timer0 handler, so every tempo
+// change lands on exactly the right sample.
+//
+// Each map entry holds the base duty cycle itself, worked out on the host by
+// song_map.py, and how many bars it lasts. The entry after the current one is
+// read and has its output duty cycles worked out ahead of time by a task
+// (SongPrefetchTask()), so all the handler does at a change point is copy
+// three words.
+//
+// The staged entry also carries its tempo in milliseconds, which replaces the
+// base tempo at the same point; speed adjustment, tapping and the sync input
+// glitch filter then carry on from the tempo actually playing.
+//
+// The song starts at power up (if a valid map for this clock is found) and is
+// restarted with a speed adjust reset. Tapping, sync input or adjusting the
+// speed takes tempo control back from it. Reading and checking the map is
+// left to SongPrefetchTask() as well, so a restart never holds up the
+// interrupts.
+//
+
+#define SONG_EEPROM_ADDRESS         0x100
+#define SONG_EEPROM_SIZE            0x100
+
+#define SONG_MAGIC                  0x53    // 'S'
+#define SONG_FLAG_LOOP              0x01    // Start over after the last entry, rather than hold its tempo.
+
+//
+// Map layout: a header, entry_count entries, then a checksum byte (inverted
+// sum of everything before it). Also see song_map.py, which writes these.
+//
+
+typedef struct
+{
+    uint8_t magic;
+    uint8_t clock_mhz;              // CLOCK_FREQUENCY the duty cycles were worked out for.
+    uint8_t entry_count;
+    uint8_t beats_per_bar;
+    uint8_t flags;
+} SongHeader;
+
+typedef struct
+{
+    uint32_t base_duty_cycle;
+    uint8_t bars;
+} SongEntry;
+
+#define SONG_ENTRY_MAX              ((SONG_EEPROM_SIZE - sizeof(SongHeader) - 1) / sizeof(SongEntry))
+
+#define SONG_END                    0xff    // No further entry to play.
+
+//
+// The next entry, staged for the Timer0 handler. Its beat count doubles as the
+// ready flag; zero until SongPrefetchTask() has filled it in.
+//
+
+typedef struct
+{
+    uint32_t base_duty_cycle;
+    uint32_t duty_cycle;
+    uint32_t poly_duty_cycle;
+    uint16_t base_tempo;            // Milliseconds, as near as base_duty_cycle comes.
+    uint16_t beats;
+} SongStep;
+
+typedef struct
+{
+    uint8_t is_playing;
+    uint8_t is_starting;            // (Re)start from the first entry on the next prefetch.
+    uint8_t entry_count;
+    uint8_t beats_per_bar;
+    uint8_t flags;
+    uint8_t next_index;             // Entry staged (or to be staged) in next; SONG_END if none.
+    uint16_t beats_left;            // Beats left of the current entry; zero once holding the last one.
+    SongStep next;
+} SongState;
+
+#if SONG_MODE
+
+//
+// Public function prototypes.
+//
+
+void RestartSong();
+void StopSong();
+TaskResult SongPrefetchTask();
+
+//
+// Public inline functions. Called from the Timer0 interrupt handler.
+//
+
+extern volatile SongState g_song;
+extern volatile uint16_t g_base_tempo;
+#if SYNC_CAPTURE
+extern volatile uint32_t g_base_tempo_ticks;
+#endif
+
+ISR_INLINE uint8_t IsSongPlaying()
+{
+    return g_song.is_playing;
+}
+
+ISR_INLINE uint8_t StepSongBeat()
+{
+    //
+    // Called on every beat. Returns 1 when the entry staged in g_song.next is
+    // due to take over, right now; the caller swaps its duty cycles in and
+    // then calls TakeSongStep().
+    //
+    
+    if ((g_song.beats_left == 0) || (--g_song.beats_left != 0))
+    {
+        return 0;
+    }
+    
+    if (g_song.next.beats != 0)
+    {
+        return 1;
+    }
+    
+    //
+    // Nothing staged. Either the song is over, and the current tempo just
+    // holds, or the prefetch hasn't got to it yet (only with very fast
+    // tempos), in which case the current tempo is stretched by a beat.
+    //
+    
+    if (g_song.next_index != SONG_END)
+    {
+        g_song.beats_left = 1;
+    }
+    
+    return 0;
+}
+
+ISR_INLINE void TakeSongStep()
+{
+    uint8_t following = g_song.next_index + 1;
+    
+    //
+    // The song's tempo is the base tempo from here on. No speed adjustment to
+    // clear; that stops the song.
+    //
+    
+    g_base_tempo = g_song.next.base_tempo;
+#if SYNC_CAPTURE
+    g_base_tempo_ticks = 0;
+#endif
+    
+    g_song.beats_left = g_song.next.beats;
+    g_song.next.beats = 0;
+    
+    if (following >= g_song.entry_count)
+    {
+        following = (g_song.flags & SONG_FLAG_LOOP) ? 0 : SONG_END;
+    }
+    
+    g_song.next_index = following;
+    
+    if (following != SONG_END)
+    {
+        ScheduleTask(TaskSongPrefetch);
+    }
+}
+
+#endif // SONG_MODE
+
+#endif // __SONG_H__
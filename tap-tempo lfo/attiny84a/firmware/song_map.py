@@ -0,0 +1,214 @@
+#!/usr/bin/env python3
+
+#
+# Compile a text tempo map (see below) into the EEPROM image played back by a
+# SONG_MODE=1 build of the attiny84a firmware (see song.h). The output is an
+# Intel HEX file covering only the song map area, so writing it with avrdude
+# leaves the field statistics in the rest of the EEPROM alone.
+#
+# Usage: song_map.py <clock> <song.txt> [song.hex]
+#
+# <clock> is the CLOCK the firmware is built for, in Hertz; the duty cycles
+# depend on the sample rate.
+#
+# Song format; one statement per line, '#' starts a comment:
+#
+#   beats <n>                   Beats per bar, for all of the song (default 4).
+#   loop                        Start over after the last entry, rather than
+#                               hold its tempo.
+#   <bars> bars <tempo>         Play <bars> bars at <tempo>.
+#   <bars> bars <tempo> > <tempo>
+#                               Ramp from the first tempo to the second over
+#                               <bars> bars, changing at every bar line.
+#
+# A tempo is a number followed by "bpm" or "ms", e.g. "128 bpm", "468.75 ms".
+#
+
+import sys
+from fractions import Fraction
+
+SONG_EEPROM_ADDRESS = 0x100
+SONG_EEPROM_SIZE = 0x100
+SONG_MAGIC = 0x53
+SONG_FLAG_LOOP = 0x01
+
+HEADER_SIZE = 5
+ENTRY_SIZE = 5
+ENTRY_MAX = (SONG_EEPROM_SIZE - HEADER_SIZE - 1) // ENTRY_SIZE
+
+WAVEFORM_RESOLUTION = 256
+LFO_MAX_TEMPO = 50          # Shortest beat, in milliseconds.
+LFO_MIN_TEMPO = 10000       # Longest beat, in milliseconds.
+
+
+def parse_tempo(words, where):
+    if len(words) != 2 or words[1] not in ('bpm', 'ms'):
+        sys.exit('%s: expected a tempo like "120 bpm" or "500 ms"' % where)
+
+    try:
+        value = Fraction(words[0])
+    except ValueError:
+        sys.exit('%s: bad tempo "%s"' % (where, words[0]))
+
+    if value <= 0:
+        sys.exit('%s: tempo must be above zero' % where)
+
+    milliseconds = (60000 / value) if words[1] == 'bpm' else value
+
+    if not (LFO_MAX_TEMPO <= milliseconds <= LFO_MIN_TEMPO):
+        sys.exit('%s: tempo outside %d - %d ms' % (where, LFO_MAX_TEMPO, LFO_MIN_TEMPO))
+
+    return milliseconds
+
+
+def parse_song(lines, name):
+    beats_per_bar = 4
+    flags = 0
+    sections = []
+
+    for number, line in enumerate(lines, 1):
+        words = line.split('#', 1)[0].split()
+        if not words:
+            continue
+
+        where = '%s:%d' % (name, number)
+
+        if words[0] == 'beats' and len(words) == 2:
+            try:
+                beats_per_bar = int(words[1])
+            except ValueError:
+                beats_per_bar = 0
+            if not (1 <= beats_per_bar <= 255):
+                sys.exit('%s: beats per bar must be 1 - 255' % where)
+
+        elif words == ['loop']:
+            flags |= SONG_FLAG_LOOP
+
+        elif len(words) >= 4 and words[1] == 'bars':
+            try:
+                bars = int(words[0])
+            except ValueError:
+                bars = 0
+            if bars < 1:
+                sys.exit('%s: bad bar count "%s"' % (where, words[0]))
+
+            if '>' in words:
+                split = words.index('>')
+                start = parse_tempo(words[2:split], where)
+                end = parse_tempo(words[split + 1:], where)
+            else:
+                start = end = parse_tempo(words[2:], where)
+
+            sections.append((bars, start, end))
+
+        else:
+            sys.exit('%s: unknown statement "%s"' % (where, ' '.join(words)))
+
+    return beats_per_bar, flags, sections
+
+
+def duty_cycle(milliseconds, clock):
+    #
+    # Phase step per sample for one cycle every <milliseconds>; the same
+    # 2^32 * frequency / sample rate as the firmware, but worked out exactly.
+    #
+
+    sample_rate = Fraction(clock, WAVEFORM_RESOLUTION)
+    return round((2 ** 32) * 1000 / (milliseconds * sample_rate))
+
+
+def to_entries(sections, clock):
+    entries = []
+
+    for bars, start, end in sections:
+        if start == end:
+            #
+            # A steady tempo only needs splitting up where the bar count
+            # doesn't fit a byte.
+            #
+
+            while bars > 0:
+                entries.append((duty_cycle(start, clock), min(bars, 255)))
+                bars -= min(bars, 255)
+        else:
+            #
+            # Ramps are linear in BPM, one entry per bar, from the start tempo
+            # on the first bar to the end tempo on the last.
+            #
+
+            start_bpm = 60000 / start
+            end_bpm = 60000 / end
+
+            for bar in range(bars):
+                position = Fraction(bar, bars - 1) if bars > 1 else Fraction(1)
+                bpm = start_bpm + ((end_bpm - start_bpm) * position)
+                entries.append((duty_cycle(60000 / bpm, clock), 1))
+
+    #
+    # Merge neighbours with the same duty cycle, as long as the bars fit.
+    #
+
+    merged = []
+    for duty, bars in entries:
+        if merged and merged[-1][0] == duty and merged[-1][1] + bars <= 255:
+            merged[-1] = (duty, merged[-1][1] + bars)
+        else:
+            merged.append((duty, bars))
+
+    return merged
+
+
+def to_image(beats_per_bar, flags, entries, clock):
+    image = bytearray([SONG_MAGIC, clock // 1000000, len(entries), beats_per_bar, flags])
+
+    for duty, bars in entries:
+        image += duty.to_bytes(4, 'little')
+        image.append(bars)
+
+    image.append(~sum(image) & 0xff)
+    return image
+
+
+def write_intel_hex(image, address, out):
+    for offset in range(0, len(image), 16):
+        chunk = image[offset:offset + 16]
+        record = bytearray([len(chunk), ((address + offset) >> 8) & 0xff, (address + offset) & 0xff, 0x00]) + chunk
+        out.write(':%s%02X\n' % (record.hex().upper(), -sum(record) & 0xff))
+
+    out.write(':00000001FF\n')
+
+
+def main():
+    if len(sys.argv) not in (3, 4):
+        sys.exit('usage: %s <clock> <song.txt> [song.hex]' % sys.argv[0])
+
+    try:
+        clock = int(sys.argv[1])
+    except ValueError:
+        sys.exit('bad clock "%s"' % sys.argv[1])
+
+    if clock % 1000000:
+        sys.exit('clock must be a whole number of MHz')
+
+    with open(sys.argv[2]) as f:
+        beats_per_bar, flags, sections = parse_song(f.readlines(), sys.argv[2])
+
+    entries = to_entries(sections, clock)
+
+    if not entries:
+        sys.exit('%s: no bars to play' % sys.argv[2])
+
+    if len(entries) > ENTRY_MAX:
+        sys.exit('%s: %d entries, but only room for %d' % (sys.argv[2], len(entries), ENTRY_MAX))
+
+    image = to_image(beats_per_bar, flags, entries, clock)
+
+    if len(sys.argv) == 4:
+        with open(sys.argv[3], 'w') as out:
+            write_intel_hex(image, SONG_EEPROM_ADDRESS, out)
+    else:
+        write_intel_hex(image, SONG_EEPROM_ADDRESS, sys.stdout)
+
+
+if __name__ == '__main__':
+    main()
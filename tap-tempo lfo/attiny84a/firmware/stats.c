@@ -0,0 +1,217 @@
+//
+// Tap-tempo LFO for 8-bit AVR.
+// 
+// Copyright (C) 2013-2016 Harald Sabro
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Contact info
+// ------------
+// Website: sabrotone.com
+// Email: harald (AT) website 
+//
+
+
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <util/atomic.h>
+
+#include "main.h"
+#include "scheduler.h"
+#include "stats.h"
+
+//
+// Defines and structs.
+//
+
+//
+// A single EEPROM record; 16 bytes, so the ring fills 0x000-0x0ff. The
+// sequence number tells which record was written last, the session number
+// which power up it belongs to, and the checksum whether it was written in
+// full. Also see decode_stats.py, which reads these back on the host.
+//
+
+typedef struct
+{
+    uint8_t sequence;
+    uint8_t session;
+    uint8_t reset_cause;
+    uint8_t max_sample_cycles;
+    uint16_t uptime_minutes;
+    uint16_t late_samples;
+    uint16_t tap_timeouts;
+    uint16_t sync_losses;
+    uint8_t task_overruns;
+    uint16_t sync_glitches;
+    uint8_t checksum;
+} StatsRecord;
+
+#define STATS_RECORD_SIZE           sizeof(StatsRecord)
+
+//
+// Local function prototypes.
+//
+
+uint8_t ReadStatsRecord(uint8_t slot, StatsRecord *record);
+uint8_t CalcStatsChecksum(const StatsRecord *record);
+
+//
+// Global variables.
+//
+
+volatile FieldStats g_stats;
+
+StatsRecord g_stats_record;                         // Record currently (or last) being written.
+uint8_t g_stats_slot;                               // Ring slot of the above.
+uint8_t g_stats_write_index = STATS_RECORD_SIZE;    // Next byte of it to write; done when at the end.
+
+/*====== Public functions ===================================================== 
+=============================================================================*/
+
+void InitializeStats(uint8_t reset_cause)
+{
+    StatsRecord record;
+    uint8_t has_previous = 0;
+    uint8_t slot;
+    
+    //
+    // Find the last record written, if any, to carry on from there. Sequence
+    // numbers wrap around, so "last" is the one the others are all behind.
+    //
+    
+    g_stats_record.sequence = 0xff;
+    g_stats_record.session = 0xff;
+    g_stats_slot = STATS_RECORD_COUNT - 1;
+    
+    for (slot = 0; slot < STATS_RECORD_COUNT; slot++)
+    {
+        if (ReadStatsRecord(slot, &record))
+        {
+            if (!has_previous || ((uint8_t)(record.sequence - g_stats_record.sequence) < 0x80))
+            {
+                g_stats_record.sequence = record.sequence;
+                g_stats_record.session = record.session;
+                g_stats_slot = slot;
+                has_previous = 1;
+            }
+        }
+    }
+    
+    g_stats_record.session++;
+    g_stats.reset_cause = reset_cause;
+    
+    //
+    // Write a first record right away, so that the reset cause is kept even
+    // when the next power down (or reset) comes before the first flush.
+    //
+    
+    ScheduleTask(TaskStatsFlush);
+}
+
+TaskResult FlushStatsTask()
+{
+    uint8_t task;
+    uint8_t overruns = 0;
+    
+    //
+    // Take a snapshot of the counters into the next record in the ring, unless
+    // a record is still being written.
+    //
+    
+    if (g_stats_write_index >= STATS_RECORD_SIZE)
+    {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            g_stats_record.reset_cause = g_stats.reset_cause;
+            g_stats_record.max_sample_cycles = g_stats.max_sample_cycles;
+            g_stats_record.uptime_minutes = g_stats.uptime_minutes;
+            g_stats_record.late_samples = g_stats.late_samples;
+            g_stats_record.tap_timeouts = g_stats.tap_timeouts;
+            g_stats_record.sync_losses = g_stats.sync_losses;
+            g_stats_record.sync_glitches = g_stats.sync_glitches;
+        }
+        
+        for (task = 0; task < TaskCount; task++)
+        {
+            overruns += GetTaskOverrunCount(task);
+            
+            if (overruns < GetTaskOverrunCount(task))
+            {
+                overruns = 0xff;
+                break;
+            }
+        }
+        
+        g_stats_record.task_overruns = overruns;
+        g_stats_record.sequence++;
+        g_stats_record.checksum = CalcStatsChecksum(&g_stats_record);
+        
+        if (++g_stats_slot >= STATS_RECORD_COUNT)
+        {
+            g_stats_slot = 0;
+        }
+        
+        g_stats_write_index = 0;
+    }
+    
+    //
+    // Each EEPROM byte takes a few milliseconds to write, so rather than
+    // waiting for it, write one byte per run and come back when it's done.
+    // Bytes that haven't changed since the last time round the ring aren't
+    // written at all.
+    //
+    
+    if (!eeprom_is_ready())
+    {
+        return TaskResultYield;
+    }
+    
+    eeprom_update_byte((uint8_t *)(STATS_EEPROM_ADDRESS + (g_stats_slot * STATS_RECORD_SIZE) + g_stats_write_index), ((uint8_t *)&g_stats_record)[g_stats_write_index]);
+    
+    if (++g_stats_write_index < STATS_RECORD_SIZE)
+    {
+        return TaskResultYield;
+    }
+    
+    return TaskResultDone;
+}
+
+/*====== Local functions ====================================================== 
+=============================================================================*/
+
+uint8_t ReadStatsRecord(uint8_t slot, StatsRecord *record)
+{
+    eeprom_read_block(record, (const void *)(STATS_EEPROM_ADDRESS + (slot * STATS_RECORD_SIZE)), STATS_RECORD_SIZE);
+    
+    return (record->checksum == CalcStatsChecksum(record));
+}
+
+uint8_t CalcStatsChecksum(const StatsRecord *record)
+{
+    const uint8_t *data = (const uint8_t *)record;
+    uint8_t sum = 0;
+    uint8_t i;
+    
+    //
+    // Inverted sum of everything but the checksum itself. Inverted so that
+    // erased EEPROM (all 0xff) doesn't pass.
+    //
+    
+    for (i = 0; i < (STATS_RECORD_SIZE - 1); i++)
+    {
+        sum += data[i];
+    }
+    
+    return ~sum;
+}
@@ -0,0 +1,147 @@
+//
+// Tap-tempo LFO for 8-bit AVR.
+// 
+// Copyright (C) 2013-2016 Harald Sabro
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Contact info
+// ------------
+// Website: sabrotone.com
+// Email: harald (AT) website 
+//
+
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <avr/io.h>
+
+#include "main.h"
+#include "scheduler.h"
+
+//
+// Field statistics. A handful of running counters kept from power up, and
+// written to a ring of records in EEPROM now and then, so there's something
+// to go on when a unit has misbehaved out in the field ("make stats" reads
+// them back).
+//
+
+//
+// Minutes between each write to EEPROM, after the one at power up. Each
+// write goes to the next record in the ring, so a given EEPROM cell is only
+// written once every STATS_RECORD_COUNT writes.
+//
+
+#define STATS_FLUSH_MINUTES         15
+
+#define STATS_EEPROM_ADDRESS        0x000
+#define STATS_RECORD_COUNT          16
+
+typedef struct
+{
+    uint8_t reset_cause;            // MCUSR at power up.
+    uint8_t max_sample_cycles;      // Longest Timer0 handler, in clock cycles since the overflow.
+    uint16_t late_samples;          // Timer0 handlers that ran into the next overflow.
+    uint16_t tap_timeouts;          // Tap tempo counts that timed out.
+    uint16_t sync_losses;           // Sync tempo counts that timed out.
+    uint16_t sync_glitches;         // Sync input glitches dropped; one per glitch, not per edge.
+    uint16_t uptime_minutes;
+    uint16_t uptime_ms_count;
+    uint8_t flush_minute_count;
+} FieldStats;
+
+//
+// Public function prototypes.
+//
+
+void InitializeStats(uint8_t reset_cause);
+TaskResult FlushStatsTask();
+
+//
+// Public inline functions. Called from the interrupt handlers, so kept to a
+// few instructions each.
+//
+
+extern volatile FieldStats g_stats;
+
+ISR_INLINE void RecordSampleTime()
+{
+    uint8_t cycles = TCNT0;
+    
+    //
+    // Timer0 runs off the system clock without a prescaler, so at the end of
+    // its handler the count is (roughly) the number of cycles it took. If the
+    // overflow flag is already set again the handler ran past the next
+    // sample, and the count has wrapped.
+    //
+    
+    if (TIFR0 & (1 << TOV0))
+    {
+        if (g_stats.late_samples < 0xffff)
+        {
+            g_stats.late_samples++;
+        }
+    }
+    else if (cycles > g_stats.max_sample_cycles)
+    {
+        g_stats.max_sample_cycles = cycles;
+    }
+}
+
+ISR_INLINE void RecordTempoTimeout(uint8_t is_sync_tempo)
+{
+    if (is_sync_tempo)
+    {
+        if (g_stats.sync_losses < 0xffff)
+        {
+            g_stats.sync_losses++;
+        }
+    }
+    else if (g_stats.tap_timeouts < 0xffff)
+    {
+        g_stats.tap_timeouts++;
+    }
+}
+
+ISR_INLINE void RecordSyncGlitch()
+{
+    if (g_stats.sync_glitches < 0xffff)
+    {
+        g_stats.sync_glitches++;
+    }
+}
+
+ISR_INLINE void CountStatsTime()
+{
+    //
+    // Called every millisecond. Counts up the uptime, and has the statistics
+    // written to EEPROM every STATS_FLUSH_MINUTES.
+    //
+    
+    if (++g_stats.uptime_ms_count >= 60000)
+    {
+        g_stats.uptime_ms_count = 0;
+        g_stats.uptime_minutes++;
+        
+        if (++g_stats.flush_minute_count >= STATS_FLUSH_MINUTES)
+        {
+            g_stats.flush_minute_count = 0;
+            
+            ScheduleTask(TaskStatsFlush);
+        }
+    }
+}
+
+#endif // __STATS_H__
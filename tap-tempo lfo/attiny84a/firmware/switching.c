@@ -23,6 +23,7 @@
 //
 
 #include <avr/io.h>
+#include <util/atomic.h>
 
 #include "main.h"
 #include "signaling.h"
@@ -32,18 +33,15 @@
 // Defines and structs.
 // 
 
-//
-// Millisecond count before considering the switch state stable.
-//
-
-#define DEBOUNCE_CHECK_COUNT        10
-
 typedef enum
 {
     SelectionModeSpeed = 0,
     SelectionModeWaveform,
     SelectionModeMultiplier,
-	SelectionModeDepth
+	SelectionModeDepth,
+    SelectionModePolyWaveform,
+    SelectionModePolyMultiplier,
+    SelectionModeRatio
 } SelectionMode;
 
 //
@@ -51,13 +49,14 @@ typedef enum
 //
 
 volatile uint8_t g_switch_samples[DEBOUNCE_CHECK_COUNT];
+volatile uint8_t g_switch_sample_index;
 
 volatile uint8_t g_closed_switch_state;
 volatile uint8_t g_open_switch_state;
 volatile uint8_t g_closed_switch_state_changed;
 volatile uint8_t g_open_switch_state_changed;
 
-volatile SelectionMode g_selection_mode = SelectionModeDepth;
+volatile SelectionMode g_selection_mode = SelectionModeRatio;
 
 volatile uint8_t g_speed_adjust_multiplier;
 volatile uint16_t g_continuous_speed_adjustments;
@@ -90,37 +89,18 @@ void InitializeSwitching()
     g_open_switch_state_changed = 0x00;
     
     //
-    // Set the selection mode to multiplier, and then toggle to the next mode
+    // Set the selection mode to the last one, and then toggle to the next mode
     // (speed adjust), also taking care of additional initialization.
     //
     
-    g_selection_mode = SelectionModeDepth;
+    g_selection_mode = SelectionModeRatio;
     SetNextSelectionMode();
-	CalcDepthTable();
+	CalcDepthScale();
     
     g_continuous_speed_adjustments = 0;
     g_speed_adjust_multiplier = 1;
 }
 
-void DebounceSwitches()
-{
-	static uint8_t switch_state_index = 0;
-	
-	//
-	// Get the current state of all PA pins and store them at whatever state
-    // index we're currently at, making sure to reset the state index whenever
-    // we go past the max count.
-	//
-	
-	g_switch_samples[switch_state_index] = PINA;
-	
-	switch_state_index++;
-	if (switch_state_index >= DEBOUNCE_CHECK_COUNT)
-	{
-		switch_state_index = 0;
-	}
-}
-
 void CalculateSwitchStates()
 {
     uint8_t count;
@@ -223,6 +203,40 @@ void SetNextSelectionMode()
             break;
          case SelectionModeDepth:
          
+            //
+            // Switch to polyrhythm waveform mode, turn on the waveform and
+            // speed adjust LEDs.
+            //
+            
+            g_selection_mode = SelectionModePolyWaveform;
+            PORTA &= ~(1 << WAVE_MODE_OUT);
+            PORTB &= ~(1 << SPEED_MODE_OUT);
+            break;
+        
+        case SelectionModePolyWaveform:
+            
+            //
+            // Switch to polyrhythm multiplier mode, turn on the waveform and
+            // multiplier LEDs.
+            //
+            
+            g_selection_mode = SelectionModePolyMultiplier;
+            PORTA &= ~((1 << WAVE_MODE_OUT) | (1 << MULTI_MODE_OUT));
+            break;
+        
+        case SelectionModePolyMultiplier:
+            
+            //
+            // Switch to ratio mode, turn on all 3 LEDs.
+            //
+            
+            g_selection_mode = SelectionModeRatio;
+            PORTA &= ~((1 << WAVE_MODE_OUT) | (1 << MULTI_MODE_OUT));
+            PORTB &= ~(1 << SPEED_MODE_OUT);
+            break;
+        
+        case SelectionModeRatio:
+        
 			 //
 			 // Switch to speed adjust mode and turn on the associated
 			 // indicator.
@@ -266,7 +280,8 @@ void ModifyCurrentSelectionMode(int8_t change_value)
                 // of each speed adjustment step. 
                 //
                 
-                if ((g_continuous_speed_adjustments % 10) == 0)
+                if (((g_continuous_speed_adjustments % 10) == 0) &&
+                    (g_speed_adjust_multiplier < SPEED_ADJUST_MULTIPLIER_MAX))
                 {
                     g_speed_adjust_multiplier += 10;
                 }
@@ -312,11 +327,65 @@ void ModifyCurrentSelectionMode(int8_t change_value)
 			SetDepth(change_value);
 			break;
         
+        case SelectionModePolyWaveform:
+            
+            SetPolyWaveform(change_value);
+            break;
+        
+        case SelectionModePolyMultiplier:
+            
+            SetPolyMultiplier(change_value);
+            break;
+        
+        case SelectionModeRatio:
+            
+            SetRatioNumerator(change_value);
+            break;
+        
         default:
             break;
     }
 }
 
+void AlternateModifyCurrentSelectionMode(int8_t change_value)
+{
+    //
+    // Push-and-turn adjustments. Modes without an alternate setting are left
+    // alone.
+    //
+    
+    switch (g_selection_mode)
+    {
+        case SelectionModeMultiplier:
+            
+            SetSyncBarLength(change_value);
+            break;
+        
+        case SelectionModeRatio:
+            
+            SetRatioDenominator(change_value);
+            break;
+        
+        default:
+            break;
+    }
+}
+
+TaskResult ResetSelectionModeTask()
+{
+    //
+    // The mode switch has been held long enough to reset the current setting
+    // (see Timer1 interrupt handler).
+    //
+    
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        ResetCurrentSelectionMode();
+    }
+    
+    return TaskResultDone;
+}
+
 void ResetCurrentSelectionMode()
 {
     switch (g_selection_mode)
@@ -339,6 +408,21 @@ void ResetCurrentSelectionMode()
 			
 			ResetDepthSetting();
 			break;
+        case SelectionModePolyWaveform:
+            
+            ResetPolyWaveformSetting();
+            break;
+        
+        case SelectionModePolyMultiplier:
+            
+            ResetPolyMultiplierSetting();
+            break;
+        
+        case SelectionModeRatio:
+            
+            ResetRatioSetting();
+            break;
+        
         default:
             break;
     }
@@ -25,24 +25,66 @@
 #ifndef __SWITCHING_H__
 #define __SWITCHING_H__
 
+#include <avr/io.h>
+
+#include "main.h"
+#include "scheduler.h"
+
 //
 // Millisecond count before a mode switch depress is interpreted as a reset.
 //
 
 #define MODE_RESET_MIN_TIME         2000
 
+//
+// Millisecond count before considering the switch state stable.
+//
+
+#define DEBOUNCE_CHECK_COUNT        10
+
+//
+// Largest step multiplier continuous speed adjustment will ramp up to. Kept
+// well clear of the 8-bit limit so the step size can't wrap back to small.
+//
+
+#define SPEED_ADJUST_MULTIPLIER_MAX  101
+
 //
 // Public function prototypes.
 //
 
 void InitializeSwitching();
-void DebounceSwitches();
 void CalculateSwitchStates();
 uint8_t SwitchWasClosed(uint8_t pins);
 uint8_t SwitchWasOpened(uint8_t pins);
 
 void SetNextSelectionMode();
 void ModifyCurrentSelectionMode(int8_t change_value);
+void AlternateModifyCurrentSelectionMode(int8_t change_value);
 void ResetCurrentSelectionMode();
+TaskResult ResetSelectionModeTask();
+
+//
+// Public inline functions. Called from the Timer1 interrupt handler.
+//
+
+extern volatile uint8_t g_switch_samples[DEBOUNCE_CHECK_COUNT];
+extern volatile uint8_t g_switch_sample_index;
+
+ISR_INLINE void DebounceSwitches()
+{
+	//
+	// Get the current state of all PA pins and store them at whatever state
+    // index we're currently at, making sure to reset the state index whenever
+    // we go past the max count.
+	//
+	
+	g_switch_samples[g_switch_sample_index] = PINA;
+	
+	if (++g_switch_sample_index >= DEBOUNCE_CHECK_COUNT)
+	{
+		g_switch_sample_index = 0;
+	}
+}
 
 #endif // __SWITCHING_H__
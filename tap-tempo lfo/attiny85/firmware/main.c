@@ -51,13 +51,28 @@
 // Defines and structs.
 //
 
-#define TIMER1_PRESCALER                32.0f
-
 //
 // Timer1 trigger rate in Hertz.
 //
 
-#define TIMER1_FREQUENCY                0.001f
+#define TIMER1_FREQUENCY                1000UL
+
+//
+// Timer1 is only 8 bits, so pick the prescaler that divides down to 250
+// counts per millisecond; i.e. 32 at 8MHz, 64 at 16MHz.
+//
+
+#if CLOCK_FREQUENCY == 8000000UL
+#define TIMER1_PRESCALER                32UL
+#define TIMER1_CLOCK_SELECT             ((1 << CS12) | (1 << CS11))
+#elif CLOCK_FREQUENCY == 16000000UL
+#define TIMER1_PRESCALER                64UL
+#define TIMER1_CLOCK_SELECT             ((1 << CS12) | (1 << CS11) | (1 << CS10))
+#else
+#error "No Timer1 prescaler set up for this clock frequency."
+#endif
+
+#define TIMER1_COMPARE                  ((CLOCK_FREQUENCY / TIMER1_PRESCALER / TIMER1_FREQUENCY) - 1)
 
 //
 // Timer1 trigger rate in milliseconds.
@@ -79,10 +94,6 @@ volatile uint8_state_flags g_state;
 
 volatile uint16_t g_tempo_ms_count;
 
-extern volatile uint8_t g_base_table_index;
-extern volatile uint32_t g_base_duty_cycle;
-extern volatile uint32_t g_base_phase_accumulator;
-
 /*====== Public functions ===================================================== 
 =============================================================================*/
 
@@ -122,6 +133,7 @@ int main()
     // Initialize signaling, including setting the default base tempo.
     //
     
+    InitializeSignaling();
     SetBaseTempo(DEFAULT_TEMPO);
     
     //
@@ -150,21 +162,22 @@ int main()
     
     //
     // The trigger value should come out as
-    // ((8,000,000 / 32.0) * 0.001) - 1 = 249
-    // which is within 8-bit range (though we could have used a 16-bit compare
-    // value for this particular timer).
+    // (8,000,000 / 32 / 1000) - 1 = 249 at 8MHz, or
+    // (16,000,000 / 64 / 1000) - 1 = 249 at 16MHz,
+    // which is within 8-bit range.
     // 
     
-    OCR1C = ((CLOCK_FREQUENCY / TIMER1_PRESCALER) * TIMER1_FREQUENCY) - 1;
+    OCR1C = TIMER1_COMPARE;
     TCCR1 = (1 << CTC1);                    // CTC mode (TOP == OCR1C).
-    TCCR1 |= (1 << CS11) | (1 << CS12);     // Prescalar of 32.
+    TCCR1 |= TIMER1_CLOCK_SELECT;           // Prescalar of 32 (8MHz) or 64 (16MHz).
     TCNT1 = 0x00;                           // Starting at 0.
     TIMSK |= (1 << OCIE1A);                 // Enable timer 1A compare.
     
     //
     // Set up ADC input pins for waveform- and multiplier selection. VCC as
     // reference voltage, and left-aligned to get an 8-bit resolution. We're
-    // using a prescaler of 128 for an interrupt frequency of 62.5kHz, and free
+    // using a prescaler of 128 for an interrupt frequency of 62.5kHz (125kHz
+    // at 16MHz, still within the ADC's 50-200kHz range), and free
     // running mode to get continuous samplings. We're going to use PB3 and PB4
     // as inputs, meaning we need to switch between MUX[1:0] = 11 (PB3) and
     // MUX[1:0] = 10 (PB4).
@@ -232,6 +245,8 @@ int main()
                 // Always reset the output signal on a manual tap.
                 //
                 
+                g_state.is_sync_tempo = 0;
+                
                 if (g_state.is_counting_tempo == 0)
                 {
                     ResetSignals();
@@ -266,68 +281,6 @@ int main()
     }
 }
 
-//
-// Timer0 overflow interrupt handler. This is where the LFO signal is
-// generated.
-// Frequency: 31.25kHz
-//
-
-ISR(TIM0_OVF_vect)
-{
-    uint8_t previous_base_table_index = g_base_table_index;
-    
-    //
-    // Increase the phase accumulator by a given amount based on the required
-    // output signal frequency. Then use the high 8 bits (0-255) of the phase
-    // accumulator to identify what part of the wave to plot.
-    //
-    // We need both the base tempo (for the LED and sync output signal), and
-    // the actual LFO signal with applied tempo multiplier.
-    //
-    // Also see PlotWaveform().
-    //
-    
-    //
-    //
-    // TODO: Might be a shortcut just dividing by the given multiplier rather
-    //       than keeping a second set of variables.
-    //
-    //
-    
-    g_base_phase_accumulator += g_base_duty_cycle;
-    g_base_table_index = (g_base_phase_accumulator & 0xff000000) >> 24;
-    
-    //
-    // Flag whenever there's an overflow in the base table index, i.e. the base
-    // tempo, has just completed a full cycle.
-    //
-    
-    if (previous_base_table_index > g_base_table_index)
-    {
-        //
-        // As long as we're not currently in tempo counting mode (where the LED
-        // will be explicitly set) toggle the LED state.
-        //
-        // The state of the LED output also doubles as a base frequency clock
-        // output pulse (low one complete base LFO cycle, then high one
-        // complete base LFO cycle) that can be used to synchronize a second
-        // (or several other) controller(s).
-        //
-        
-        if (g_state.is_counting_tempo == 0)
-        {
-            PORTB ^= (1 << SYNC_OUT);   // Pull high->low or low->high.
-            //AlignWaveform();
-        }
-    }
-    
-    //
-    // Draw the next point on the waveform.
-    //
-    
-    PlotWaveform();
-}
-
 //
 // Timer1 compare interrupt handler. Triggers every k_timer1_frequency seconds.
 // Frequency: 1kHz
@@ -441,6 +394,7 @@ ISR(PCINT0_vect)
     if (sync_input != previous_sync_input)
     {
         previous_sync_input = sync_input;
+        g_state.is_sync_tempo = 1;
 
         //
         // Detect whether this is a falling or rising edge, and start or stop
@@ -26,11 +26,24 @@
 #define __MAIN_H__
 
 //
-// Fuse bits set to internal 8MHz clock (default), and no clock division (not
-// default).
+// System clock, passed in from the Makefile (CLOCK). Either the internal 8MHz
+// clock (default) with no clock division (not default), or 16MHz from the
+// internal PLL. Everything timing related is derived from this.
 //
 
-#define CLOCK_FREQUENCY     			8000000UL
+#ifndef F_CPU
+#define F_CPU                           8000000UL
+#endif
+
+#define CLOCK_FREQUENCY     			F_CPU
+
+//
+// Functions making up the interrupt handlers are forced inline. Any call from
+// an ISR makes avr-gcc save and restore every call-clobbered register on top
+// of the call itself ("make isr-check" verifies that there are none).
+//
+
+#define ISR_INLINE                      static inline __attribute__((always_inline))
 
 //
 // Pin configuration defines for attiny85.
@@ -58,7 +71,8 @@ typedef struct
     uint8_t is_counting_tempo:1;
     uint8_t has_random_seed:1;
     uint8_t has_received_tap_input:1;
-    uint8_t reserved:5;
+    uint8_t is_sync_tempo:1;
+    uint8_t reserved:4;
 } uint8_state_flags;
 
 #endif // __MAIN_H__
@@ -23,10 +23,12 @@
 //
 
 #include <avr/io.h>
-#include <stdlib.h>
+#include <avr/interrupt.h>
 
 #include "main.h"
 #include "signaling.h"
+#include "taptempo.h"
+#include "tempo.h"
 
 //
 // Available waveforms.
@@ -43,7 +45,12 @@ typedef enum
     WaveformCount           // Dummy entry to get the enum count.
 } Waveform;
 
-#define WAVEFORM_READING_INDEX_RANGE        (256.0 / WaveformCount)
+//
+// Map an 8-bit ADC reading onto an (almost) equal share of the range for each
+// index; i.e. value / (256 / count), as a multiply and shift.
+//
+
+#define WAVEFORM_READING_INDEX(value)       (((uint16_t)(value) * WaveformCount) >> 8)
 
 //
 // Available tempo multipliers.
@@ -64,52 +71,53 @@ typedef enum
     MultiplierCount         // Dummy entry to get the enum count.
 } Multiplier;
 
-#define MULTIPLIER_READING_INDEX_RANGE      (256.0 / MultiplierCount)
+#define MULTIPLIER_READING_INDEX(value)     (((uint16_t)(value) * MultiplierCount) >> 8)
 
 //
 // Calculate duty cycle for multiplier[x] by taking the base duty cycle and
-// multiplying by the correct ratio.
+// multiplying by the correct ratio; numerator / denominator.
 //
 
-static const float k_multiplier_ratio[MultiplierCount] =
+typedef struct
 {
-    0.25,       // Whole note.              (1/4) = 0.25 rate
-    0.333334,   // Dotted half note.        (1/3) = ~0.333334 rate
-    0.5,        // Half note.               (1/2) = 0.5 rate
-    0.666667,   // Dotted quarter note.     (2/3) = ~0.666667 rate
-    1.0,        // Quarter note.            (1/1) = 1 rate
-    1.333334,   // Dotted eighth note.      (4/3) = ~1.333334 rate
-    2.0,        // Eighth note.             (2/1) = 2 rate
-    2.666667,   // Dotted sixteenth note.   (8/3) = ~2,666667 rate
-    //3.0,        // Triplet note.            (3/1) = 3 rate
-    4.0         // Sixteenth note.          (4/1) = 4 rate
-};
+    uint8_t numerator;
+    uint8_t denominator;
+} MultiplierRatio;
 
-static const uint8_t k_multiplier_alignment[MultiplierCount] =
+static const MultiplierRatio k_multiplier_ratio[MultiplierCount] =
 {
-    4,  // Whole note.              Matches base tempo at 4/4.
-    3,  // Dotted half note.        Matches base tempo at 3/4. 
-    2,  // Half note.               Matches base tempo at 2/4.
-    3,  // Dotted quarter note.     Matches base tempo at 3/4.
-    1,  // Quarter note.            Base tempo. 
-    3,  // Dotted eighth note.      Matches base tempo at 3/4.
-    1,  // Eighth note.             Matches base tempo at 1/4.
-    3,  // Dotted sixteenth note.   Matches base tempo at 3/4.
-    //2,  // Triplet note.            Matches base tempo at 1/4.
-    1   // Sixteenth note.          Matches base tempo at 1/4.
+    { 1, 4 },   // Whole note.              (1/4) = 0.25 rate
+    { 1, 3 },   // Dotted half note.        (1/3) = ~0.333334 rate
+    { 1, 2 },   // Half note.               (1/2) = 0.5 rate
+    { 2, 3 },   // Dotted quarter note.     (2/3) = ~0.666667 rate
+    { 1, 1 },   // Quarter note.            (1/1) = 1 rate
+    { 4, 3 },   // Dotted eighth note.      (4/3) = ~1.333334 rate
+    { 2, 1 },   // Eighth note.             (2/1) = 2 rate
+    { 8, 3 },   // Dotted sixteenth note.   (8/3) = ~2,666667 rate
+    //{ 3, 1 },   // Triplet note.            (3/1) = 3 rate
+    { 4, 1 }    // Sixteenth note.          (4/1) = 4 rate
 };
 
 //
-// Number of base tempo counts between each time all multipliers align.
+// Number of base tempo counts between each time all multipliers align; the
+// least common multiple of their alignment periods (the denominators above:
+// whole notes line up with the base tempo every 4/4, dotted notes every 3/4
+// and so on). The alignment count runs over this span whatever the current
+// multiplier, so a new one lines up as if it had been running since the last
+// tap or sync.
 //
 
 #define MULTIPLIER_ALIGNMENT_OFFSET     12
 
 //
-// Book keeping defines.
+// The LFO output's place in g_alignment (see lib/taptempo/tempo.h).
 //
 
-#define TEMPO_TO_FREQUENCY              1000.0f
+#define ALIGNMENT_LFO                   0
+
+//
+// Book keeping defines.
+//
 
 #define WAVEFORM_RESOLUTION             256
 
@@ -148,12 +156,69 @@ static const uint8_t k_sine_table[WAVEFORM_RESOLUTION] =
 // 8MHz / 128 =  62.50kHz
 // 8MHz /  64 = 125.00kHz
 //
+// 16MHz / 256 = 62.50kHz
+//
 
 #define TIMER0_SAMPLE_RATE              (CLOCK_FREQUENCY / WAVEFORM_RESOLUTION)
-#define DUTY_CYCLE_DIVISOR              (0x100000000 / TIMER0_SAMPLE_RATE)
+
+//
+// The constant part of the duty cycle (phase step per sample) for a tempo,
+// worked out here at compile time, leaving a single integer division at run
+// time (see lib/taptempo/tempo.h).
+//
+
+#define DUTY_CYCLE_DIVIDEND             TEMPO_DUTY_CYCLE_DIVIDEND(CLOCK_FREQUENCY, WAVEFORM_RESOLUTION)
+
+//
+// BPM_QUANTIZE (Makefile) snaps the tempo to the nearest whole BPM (1) or half
+// BPM (2); 0 leaves it at the millisecond count. The duty cycle is then worked
+// out from the BPM instead of the milliseconds, so a tempo like 128 BPM
+// (468.75ms) comes out exact, and the same on every unit.
+//
+
+#ifndef BPM_QUANTIZE
+#define BPM_QUANTIZE                    0
+#endif
+
+#if BPM_QUANTIZE
+#define BPM_QUANTIZE_DIVIDEND           TEMPO_BPM_QUANTIZE_DIVIDEND(BPM_QUANTIZE)
+#define BPM_STEP_DUTY_CYCLE             TEMPO_BPM_STEP_DUTY_CYCLE(CLOCK_FREQUENCY, WAVEFORM_RESOLUTION, BPM_QUANTIZE)
+#endif
+
+//
+// The "random" waveform picks one of a few levels each cycle, taken from the
+// top bits of a 16-bit xorshift (7, 9, 8; period 2^16 - 1). Keeping only the
+// top bits of a random byte avoids a multiply (no hardware MUL). A single LFSR
+// shift per level would leave each level only two possible successors.
+//
 
 #define WAVEFORM_RANDOM_STEP_COUNT      8
-#define WAVEFORM_STEP_SIZE              (0xff / WAVEFORM_RANDOM_STEP_COUNT)
+#define WAVEFORM_RANDOM_MASK            ((uint8_t)~((0x100 / WAVEFORM_RANDOM_STEP_COUNT) - 1))
+
+//
+// Everything the Timer0 handler touches on each sample lives in one struct,
+// in the order the handler gets to it. The handler then only needs a single
+// pointer register (Y or Z) and reaches every field with a one word LDD/STD
+// plus displacement, rather than a two word LDS/STS with the absolute address
+// each time. The displacement only goes up to 63, so keep the struct within
+// the first 64 bytes.
+//
+
+typedef struct
+{
+    uint32_t phase_accumulator;
+    uint32_t duty_cycle;
+    uint8_t table_index;
+} DdsChannel;
+
+typedef struct
+{
+    DdsChannel base;            // Base tempo (for the LED and sync output).
+    DdsChannel lfo;             // LFO output, with the multiplier applied.
+    Waveform waveform;
+    uint8_t random_number;      // Used with the "random" waveform.
+    uint16_t random_register;
+} DdsState;
 
 //
 // Local function prototypes.
@@ -161,55 +226,75 @@ static const uint8_t k_sine_table[WAVEFORM_RESOLUTION] =
 
 void ResetBaseTempo();
 void RecalculateTempo();
+uint32_t CalcBaseDutyCycle(uint16_t tempo);
 void AdjustPhaseAccumulation();
+ISR_INLINE volatile DdsState *LoadDdsPointer();
+ISR_INLINE void PlotWaveform(volatile DdsState *dds);
+ISR_INLINE void StepRandomNumber(volatile DdsState *dds);
 
 //
 // Global variables.
 //
 
-volatile uint8_t g_random_number;   // Used with the "random" waveform.
+volatile DdsState g_dds =
+{
+    .base = { .table_index = 0xff },
+    .waveform = WaveformSine,
+    .random_register = 0xace1
+};
 
 volatile uint16_t g_base_tempo;
 
-volatile uint32_t g_base_duty_cycle;
-volatile uint8_t g_base_table_index = 0xff;
-volatile uint32_t g_base_phase_accumulator;
-volatile uint32_t g_duty_cycle;
-volatile uint8_t g_table_index = 0;
-volatile uint32_t g_phase_accumulator;
-
-volatile uint8_t g_multiplier_alignment_index;
+volatile TempoAlignment g_alignment = TEMPO_ALIGNMENT_INIT(MULTIPLIER_ALIGNMENT_OFFSET);
 
-volatile Waveform g_waveform = WaveformSine;
 volatile Multiplier g_multiplier = MultiplierQuarter;
 
-extern volatile uint8_state_flags g_state;
-extern volatile uint16_t g_tempo_ms_count;
+//
+// Tap interval tracking, shared with the host side tools (lib/taptempo). Only
+// touched from SetBaseTempo() and InitializeSignaling(), which both run with
+// interrupts disabled.
+//
+
+TapTempo g_tap_tempo;
 
 /*====== Public functions ===================================================== 
 =============================================================================*/
 
+void InitializeSignaling()
+{
+    TapTempoInitialize(&g_tap_tempo, LFO_MAX_TEMPO, LFO_MIN_TEMPO);
+}
+
 void SetBaseTempo(uint16_t milliseconds)
 {
     //
-    // Do some boundary checking on the requested frequency. We're only going
-    // to accept frequencies in the range of 0.1Hz - 20Hz.
+    // The interval goes through the shared tap tempo tracker, which only
+    // accepts frequencies in the range of 0.1Hz - 20Hz, and averages the tap
+    // intervals with TAP_AVERAGING (Makefile). Otherwise, and for sync input,
+    // it starts afresh every time and hands the interval straight back; no
+    // division involved.
     //
     
-    if ((milliseconds > LFO_MIN_TEMPO) || (milliseconds < LFO_MAX_TEMPO))
+#if TAP_AVERAGING
+    if (g_state.is_sync_tempo == 1)
+#endif
+    {
+        InitializeSignaling();
+    }
+    
+    milliseconds = TapTempoAddInterval(&g_tap_tempo, milliseconds);
+    
+    if (milliseconds == 0)
     {
         return;
     }
     
     //
     // No need to recalculate if the new tempo count is just a few milliseconds
-    // off (would be typical when running off an external clock pulse).
-    //
-    // 2ms +/- seems to eliminate any syncing irregularities when clocked from
-    // an external tap-tempo chip.
+    // off (see TEMPO_CHANGE_TOLERANCE).
     //
     
-    if ((g_base_tempo > (milliseconds + 2)) || (g_base_tempo < (milliseconds - 2)))
+    if (TempoIsChange(g_base_tempo, milliseconds))
     {
         //
         // Store the new base tempo and recalculate how that affects the actual
@@ -257,44 +342,237 @@ void StopTempoCount()
     PORTB |= (1 << SYNC_OUT);   // Pull high.
 }
 
-void TempoCountTimeout()
+void ResetSignals()
+{
+    ResetBaseTempo();
+    
+    g_dds.lfo.phase_accumulator = 0;
+    g_dds.lfo.table_index = 0;
+    
+    TempoResetAlignment(&g_alignment);
+}
+
+void SeedRandomNumberGenerator(uint32_t seed)
 {
     //
-    // Exit the tempo counting state without making any changes, discarding any
-    // tempo count.
+    // The xorshift generator locks up if it is ever all zeros.
     //
     
-    g_state.is_counting_tempo = 0;
-    g_tempo_ms_count = 0;
+    g_dds.random_register = (seed & 0xffff) | 0x0001;
 }
 
-void ResetSignals()
+void UpdateRandomNumber()
 {
-    ResetBaseTempo();
+    StepRandomNumber(&g_dds);
+}
+
+void AlignWaveform()
+{
+    //
+    // Align the phase accumulator appropriately based on the waveform
+    // multiplier. Each multiplier aligns with the base tempo at different
+    // intervals (see TempoStepAlignment()).
+    //
     
-    g_phase_accumulator = 0;
-    g_table_index = 0;
+    if (TempoStepAlignment(&g_alignment) & (1 << ALIGNMENT_LFO))
+    {
+        g_dds.lfo.phase_accumulator = 0;
+    }
+}
+
+void SetWaveform(uint8_t value)
+{
+    static int16_t previous_value = 0;
+    uint8_t reading_index;
     
-    g_multiplier_alignment_index = 0;
+    //
+    // Give the ADC reading a slack of +/- 2 to allow for small fluctuations.
+    // This comes out to 1 = 5V / 256 ~= 20mV --> i.e. +/- 40mV.
+    //
+    
+    if ((previous_value > (int16_t)(value + 2)) || (previous_value < (int16_t)(value - 2)))
+    {
+        //
+        // Each waveform is assigned an equal (almost) range of the possible
+        // 8-bit reading. By dividing the current reading by this range we end
+        // up with the index corresponding to the waveform.
+        //
+        // Note: The reading is at most 255, so the index always stays below
+        //       the waveform count.
+        //
+        
+        reading_index = WAVEFORM_READING_INDEX(value);
+        
+        g_dds.waveform = reading_index;
+    }
+    
+    previous_value = value;
 }
 
-void SeedRandomNumberGenerator(uint32_t seed)
+void SetMultiplier(uint8_t value)
 {
-    srand(seed);
+    static int16_t previous_value = 0;
+    uint8_t reading_index;
+    
+    //
+    // Give the ADC reading a slack of +/- 2 to allow for small fluctuations.
+    // This comes out to 1 = 5V / 256 ~= 20mV --> i.e. +/- 40mV.
+    //
+    
+    if ((previous_value > (int16_t)(value + 2)) || (previous_value < (int16_t)(value - 2)))
+    {
+        //
+        // Each multiplier is assigned an equal (almost) range of the possible
+        // 8-bit reading. By dividing the current reading by this range we end
+        // up with the index corresponding to the waveform.
+        //
+        // Note: The reading is at most 255, so the index always stays below
+        //       the multiplier count.
+        //
+        
+        reading_index = MULTIPLIER_READING_INDEX(value);
+        
+        //
+        // Only change the multiplier if it's different.
+        //
+        
+        if (reading_index != g_multiplier)
+        {
+            g_multiplier = reading_index;
+            
+            TempoSetRatio(&g_alignment, ALIGNMENT_LFO, k_multiplier_ratio[g_multiplier].numerator, k_multiplier_ratio[g_multiplier].denominator);
+            RecalculateTempo();
+            AdjustPhaseAccumulation();
+        }
+    }
+    
+    previous_value = value;
 }
 
-void UpdateRandomNumber()
+//
+// Timer0 overflow interrupt handler. This is where the LFO signal is
+// generated.
+// Frequency: 31.25kHz (62.5kHz at 16MHz)
+//
+// Note: Lives here rather than in main.c so the whole handler can be inlined
+//       into a single function, without any calls.
+//
+
+ISR(TIM0_OVF_vect)
 {
+    volatile DdsState *dds = LoadDdsPointer();
+    uint8_t previous_base_table_index = dds->base.table_index;
+    
+    //
+    // Increase the phase accumulator by a given amount based on the required
+    // output signal frequency. Then use the high 8 bits (0-255) of the phase
+    // accumulator to identify what part of the wave to plot.
+    //
+    // We need both the base tempo (for the LED and sync output signal), and
+    // the actual LFO signal with applied tempo multiplier.
+    //
+    // Also see PlotWaveform().
+    //
+    
+    dds->base.phase_accumulator += dds->base.duty_cycle;
+    dds->base.table_index = (dds->base.phase_accumulator & 0xff000000) >> 24;
+    
+    //
+    // Flag whenever there's an overflow in the base table index, i.e. the base
+    // tempo, has just completed a full cycle.
     //
-    // Generate a "random" number within the specified range.
+    
+    if (previous_base_table_index > dds->base.table_index)
+    {
+        //
+        // As long as we're not currently in tempo counting mode (where the LED
+        // will be explicitly set) toggle the LED state.
+        //
+        // The state of the LED output also doubles as a base frequency clock
+        // output pulse (low one complete base LFO cycle, then high one
+        // complete base LFO cycle) that can be used to synchronize a second
+        // (or several other) controller(s).
+        //
+        
+        if (g_state.is_counting_tempo == 0)
+        {
+            PORTB ^= (1 << SYNC_OUT);   // Pull high->low or low->high.
+        }
+    }
+    
+    //
+    // Draw the next point on the waveform.
     //
     
-    g_random_number = (rand() % WAVEFORM_RANDOM_STEP_COUNT) * WAVEFORM_STEP_SIZE;
+    PlotWaveform(dds);
 }
 
-void PlotWaveform()
+/*====== Local functions ====================================================== 
+=============================================================================*/
+
+void ResetBaseTempo()
 {
-    uint8_t previous_table_index = g_table_index;
+    //
+    // Reset phase accumulator and wave table index for the base tempo.
+    //
+    
+    g_dds.base.table_index = 0;
+    g_dds.base.phase_accumulator = 0;
+}
+
+void RecalculateTempo()
+{
+    g_dds.base.duty_cycle = CalcBaseDutyCycle(g_base_tempo);
+    
+    //
+    // Use the base duty cycle and the current multiplier to calculate the
+    // working duty cycle.
+    //
+    
+    g_dds.lfo.duty_cycle = (g_dds.base.duty_cycle * k_multiplier_ratio[g_multiplier].numerator) / k_multiplier_ratio[g_multiplier].denominator;
+}
+
+uint32_t CalcBaseDutyCycle(uint16_t tempo)
+{
+#if BPM_QUANTIZE
+    return TempoCalcQuantizedDutyCycle(BPM_QUANTIZE_DIVIDEND, BPM_STEP_DUTY_CYCLE, tempo);
+#else
+    return TempoCalcDutyCycle(DUTY_CYCLE_DIVIDEND, tempo);
+#endif
+}
+
+void AdjustPhaseAccumulation()
+{
+    //
+    // When the tempo multiplier has changed, the working phase accumulator
+    // also have to change to reflect how far the new duty cycle would have
+    // got had it been running from the start (see TempoCalcPhase()).
+    //
+    // By doing this the current tempo with multiplier will keep in sync with
+    // the base tempo.
+    //
+    
+    g_dds.lfo.phase_accumulator = TempoCalcPhase(&g_alignment, ALIGNMENT_LFO, g_dds.base.phase_accumulator);
+}
+
+ISR_INLINE volatile DdsState *LoadDdsPointer()
+{
+    volatile DdsState *dds = &g_dds;
+    
+    //
+    // Hide where the pointer points from the compiler, so it has to keep it in
+    // a base pointer register ("b"; Y or Z) and use displacement addressing,
+    // rather than folding it back into an absolute address for every access.
+    //
+    
+    __asm__ ("" : "+b" (dds));
+    
+    return dds;
+}
+
+ISR_INLINE void PlotWaveform(volatile DdsState *dds)
+{
+    uint8_t previous_table_index = dds->lfo.table_index;
     
     //
     // Calculate the next waveform table index. The phase accumulator keeps
@@ -304,14 +582,14 @@ void PlotWaveform()
     // the full waveform slower or faster based on each of these steps.
     //
     
-    g_phase_accumulator += g_duty_cycle;
-    g_table_index = (g_phase_accumulator & 0xff000000) >> 24;
+    dds->lfo.phase_accumulator += dds->lfo.duty_cycle;
+    dds->lfo.table_index = (dds->lfo.phase_accumulator & 0xff000000) >> 24;
     
     //
     // Now plot a single point on the selected waveform.
     //
     
-    switch (g_waveform)
+    switch (dds->waveform)
     {
         case WaveformSine:
         
@@ -320,7 +598,7 @@ void PlotWaveform()
             // value.
             //
         
-            OCR0A = k_sine_table[g_table_index];
+            OCR0A = k_sine_table[dds->lfo.table_index];
             break;
         
         case WaveformRampUp:
@@ -333,7 +611,7 @@ void PlotWaveform()
             // Easily calculated; x = i
             //
         
-            OCR0A = g_table_index;
+            OCR0A = dds->lfo.table_index;
             break;
         
         case WaveformRampDown:
@@ -346,7 +624,7 @@ void PlotWaveform()
             // Easily calculated; x = max - i
             //
         
-            OCR0A = 0xff - g_table_index;
+            OCR0A = 0xff - dds->lfo.table_index;
             break;
         
         case WaveformTriangle:
@@ -359,13 +637,13 @@ void PlotWaveform()
             // Easily calculated; first half: x = 2i, second half: x = max - 2i
             //
         
-            if (g_table_index < 0x80)
+            if (dds->lfo.table_index < 0x80)
             {
-                OCR0A = g_table_index * 2;
+                OCR0A = dds->lfo.table_index * 2;
             }
             else
             {
-                OCR0A = 0xff - ((g_table_index - 0x80) * 2);
+                OCR0A = 0xff - ((dds->lfo.table_index - 0x80) * 2);
             }
             break;
         
@@ -379,7 +657,7 @@ void PlotWaveform()
             // Easily calculated; first half: x = min, second half: x = max
             //
         
-            if (g_table_index < 0x80)
+            if (dds->lfo.table_index < 0x80)
             {
                 OCR0A = 0x00;
             }
@@ -396,7 +674,7 @@ void PlotWaveform()
             // this number each complete waveform cycle.
             //
             
-            OCR0A = g_random_number;
+            OCR0A = dds->random_number;
             break;
         
         default:
@@ -404,178 +682,29 @@ void PlotWaveform()
             break;
     }
     
-    if (previous_table_index > g_table_index)
+    if (previous_table_index > dds->lfo.table_index)
     {
         //
         // Update the random number for the random waveform.
         //
         
-        UpdateRandomNumber();
-    }
-}
-
-void AlignWaveform()
-{
-    //
-    // Before proceeding, make sure the index isn't out of bounds.
-    //
-    
-    if (g_multiplier_alignment_index >= MULTIPLIER_ALIGNMENT_OFFSET)
-    {
-        g_multiplier_alignment_index = 0;
-    }
-    
-    //
-    // Align the phase accumulator appropriately based on the waveform
-    // multiplier. Each multiplier aligns with the base tempo at different
-    // intervals.
-    //
-    
-    if ((g_multiplier_alignment_index % k_multiplier_alignment[g_multiplier]) == 0)
-    {
-        g_phase_accumulator = 0;
-    }
-    
-    g_multiplier_alignment_index++;
-}
-
-void SetWaveform(uint8_t value)
-{
-    static int16_t previous_value = 0;
-    uint8_t reading_index;
-    
-    //
-    // Give the ADC reading a slack of +/- 2 to allow for small fluctuations.
-    // This comes out to 1 = 5V / 256 ~= 20mV --> i.e. +/- 40mV.
-    //
-    
-    if ((previous_value > (int16_t)(value + 2)) || (previous_value < (int16_t)(value - 2)))
-    {
-        //
-        // Each waveform is assigned an equal (almost) range of the possible
-        // 8-bit reading. By dividing the current reading by this range we end
-        // up with the index corresponding to the waveform.
-        //
-        // Note: Due to floating point truncation there might be a small range
-        //       at the very top assigned to the next index, which will have to
-        //       be accounted for. 
-        //
-        
-        reading_index = (value / WAVEFORM_READING_INDEX_RANGE);
-        if (reading_index >= WaveformCount)
-        {
-            reading_index = WaveformCount - 1;
-        }
-        
-        g_waveform = reading_index;
-    }
-    
-    previous_value = value;
-}
-
-void SetMultiplier(uint8_t value)
-{
-    static int16_t previous_value = 0;
-    uint8_t reading_index;
-    
-    //
-    // Give the ADC reading a slack of +/- 2 to allow for small fluctuations.
-    // This comes out to 1 = 5V / 256 ~= 20mV --> i.e. +/- 40mV.
-    //
-    
-    if ((previous_value > (int16_t)(value + 2)) || (previous_value < (int16_t)(value - 2)))
-    {
-        //
-        // Each multiplier is assigned an equal (almost) range of the possible
-        // 8-bit reading. By dividing the current reading by this range we end
-        // up with the index corresponding to the waveform.
-        //
-        // Note: Due to floating point truncation there might be a small range
-        //       at the very top assigned to the next index, which will have to
-        //       be accounted for. 
-        //
-        
-        reading_index = value / MULTIPLIER_READING_INDEX_RANGE;
-        if (reading_index >= MultiplierCount)
-        {
-            reading_index = MultiplierCount - 1;
-        }
-        
-        //
-        // Only change the multiplier if it's different.
-        //
-        
-        if (reading_index != g_multiplier)
-        {
-            g_multiplier = reading_index;
-            
-            RecalculateTempo();
-            AdjustPhaseAccumulation();
-        }
+        StepRandomNumber(dds);
     }
-    
-    previous_value = value;
 }
 
-/*====== Local functions ====================================================== 
-=============================================================================*/
-
-void ResetBaseTempo()
+ISR_INLINE void StepRandomNumber(volatile DdsState *dds)
 {
-    //
-    // Reset phase accumulator and wave table index for the base tempo.
-    //
-    
-    g_base_table_index = 0;
-    g_base_phase_accumulator = 0;
-}
-
-void RecalculateTempo()
-{
-    float new_frequency;
-
-    //
-    // Convert the new tempo from a millisecond count to a frequency.
-    //
-    
-    new_frequency = (TEMPO_TO_FREQUENCY / (float)g_base_tempo);
+    uint16_t bits = dds->random_register;
     
     //
-    // Recalculate the base duty cycle based on the new frequency.
+    // xorshift step; the 8-bit shift is a plain byte move on the AVR. Then
+    // generate a "random" number within the specified range.
     //
     
-    g_base_duty_cycle = new_frequency * DUTY_CYCLE_DIVISOR;
-    
-    //
-    // Use the base duty cycle and the current multiplier to calculate the
-    // working duty cycle.
-    //
-    
-    g_duty_cycle = g_base_duty_cycle * k_multiplier_ratio[g_multiplier];
-}
-
-void AdjustPhaseAccumulation()
-{
-    //
-    // When the tempo multiplier has changed, the working phase accumulator
-    // also have to change to reflect how far the new duty cycle would have
-    // got had it been running from the start.
-    //
-    // By doing this the current tempo with multiplier will keep in sync with
-    // the base tempo.
-    //
-    // Note: For multipliers faster than 1:1 tempo the 32-bit working phase
-    //       accumulator will overflow and wrap around before the base one has
-    //       had a chance to do so. Fortunately, multiplying by the ratio to
-    //       get the new phase accumulator also overflows at 32 bits and the
-    //       end result is the same (at least it seems to work that way when
-    //       testing).
-    //
-    // Note 2: Because not all multipliers produce waveforms that align on
-    //         every base cycle, the multiplier alignemnt index also has to be
-    //         taken into account when finding the correct phase accumulator.
-    //         See AlignWaveform() for more details on this.
-    //
+    bits ^= bits << 7;
+    bits ^= bits >> 9;
+    bits ^= bits << 8;
     
-    g_phase_accumulator = g_base_phase_accumulator * (k_multiplier_ratio[g_multiplier] * g_multiplier_alignment_index);
+    dds->random_register = bits;
+    dds->random_number = (bits >> 8) & WAVEFORM_RANDOM_MASK;
 }
@@ -25,6 +25,8 @@
 #ifndef __SIGNALING_H__
 #define __SIGNALING_H__
 
+#include "main.h"
+
 //
 // Defines and structs.
 //
@@ -45,17 +47,34 @@
 // Public function prototypes.
 //
 
+void InitializeSignaling();
 void SetBaseTempo(uint16_t milliseconds);
 void StartTempoCount();
 void StopTempoCount();
-void TempoCountTimeout();
 void ResetSignals();
 
 void SeedRandomNumberGenerator(uint32_t seed);
 void UpdateRandomNumber();
-void PlotWaveform();
 void AlignWaveform();
 void SetWaveform(uint8_t value);
 void SetMultiplier(uint8_t value);
 
+//
+// Public inline functions. Called from the Timer1 interrupt handler.
+//
+
+extern volatile uint8_state_flags g_state;
+extern volatile uint16_t g_tempo_ms_count;
+
+ISR_INLINE void TempoCountTimeout()
+{
+    //
+    // Exit the tempo counting state without making any changes, discarding any
+    // tempo count.
+    //
+    
+    g_state.is_counting_tempo = 0;
+    g_tempo_ms_count = 0;
+}
+
 #endif // __SIGNALING_H__
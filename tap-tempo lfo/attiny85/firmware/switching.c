@@ -32,17 +32,12 @@
 // Defines and structs.
 // 
 
-//
-// Millisecond count before considering the switch state stable.
-//
-
-#define DEBOUNCE_CHECK_COUNT        10
-
 //
 // Global variables.
 //
 
 volatile uint8_t g_switch_samples[DEBOUNCE_CHECK_COUNT];
+volatile uint8_t g_switch_sample_index;
 
 volatile uint8_t g_closed_switch_state;
 volatile uint8_t g_open_switch_state;
@@ -76,25 +71,6 @@ void InitializeSwitching()
     g_open_switch_state_changed = 0x00;
 }
 
-void DebounceSwitches()
-{
-	static uint8_t switch_state_index = 0;
-	
-	//
-	// Get the current state of all PA pins and store them at whatever state
-    // index we're currently at, making sure to reset the state index whenever
-    // we go past the max count.
-	//
-	
-	g_switch_samples[switch_state_index] = PINB;
-	
-	switch_state_index++;
-	if (switch_state_index >= DEBOUNCE_CHECK_COUNT)
-	{
-		switch_state_index = 0;
-	}
-}
-
 void CalculateSwitchStates()
 {
     uint8_t count;
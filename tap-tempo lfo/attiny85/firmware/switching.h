@@ -25,14 +25,46 @@
 #ifndef __SWITCHING_H__
 #define __SWITCHING_H__
 
+#include <avr/io.h>
+
+#include "main.h"
+
+//
+// Millisecond count before considering the switch state stable.
+//
+
+#define DEBOUNCE_CHECK_COUNT        10
+
 //
 // Public function prototypes.
 //
 
 void InitializeSwitching();
-void DebounceSwitches();
 void CalculateSwitchStates();
 uint8_t SwitchWasClosed(uint8_t pins);
 uint8_t SwitchWasOpened(uint8_t pins);
 
+//
+// Public inline functions. Called from the Timer1 interrupt handler.
+//
+
+extern volatile uint8_t g_switch_samples[DEBOUNCE_CHECK_COUNT];
+extern volatile uint8_t g_switch_sample_index;
+
+ISR_INLINE void DebounceSwitches()
+{
+	//
+	// Get the current state of all PB pins and store them at whatever state
+    // index we're currently at, making sure to reset the state index whenever
+    // we go past the max count.
+	//
+	
+	g_switch_samples[g_switch_sample_index] = PINB;
+	
+	if (++g_switch_sample_index >= DEBOUNCE_CHECK_COUNT)
+	{
+		g_switch_sample_index = 0;
+	}
+}
+
 #endif // __SWITCHING_H__